@@ -0,0 +1,111 @@
+/*
+ * ACPI - System Resource Affinity Table (SRAT)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "acpi_table.hpp"
+
+#pragma pack(1)
+
+/*
+ * Static Resource Affinity Structure (5.2.16)
+ */
+class Acpi_affinity
+{
+    public:
+        uint8   type;
+        uint8   length;
+
+        enum Type
+        {
+            LAPIC   = 0,
+            MEMORY  = 1,
+            X2APIC  = 2,
+        };
+};
+
+/*
+ * Processor Local APIC/SAPIC Affinity Structure (5.2.16.1)
+ */
+class Acpi_affinity_lapic : public Acpi_affinity
+{
+    public:
+        uint8   pxm_lo;
+        uint8   apic_id;
+        uint32  flags;
+        uint8   sapic_eid;
+        uint8   pxm_hi[3];
+        uint32  clock_domain;
+
+        uint32 pxm() const { return pxm_lo | pxm_hi[0] << 8 | pxm_hi[1] << 16 | pxm_hi[2] << 24; }
+};
+
+/*
+ * Memory Affinity Structure (5.2.16.2)
+ */
+class Acpi_affinity_mem : public Acpi_affinity
+{
+    public:
+        uint32  pxm;
+        uint16  reserved1;
+        uint64  base;
+        uint64  size;
+        uint32  reserved2;
+        uint32  flags;
+        uint64  reserved3;
+};
+
+/*
+ * Processor Local x2APIC Affinity Structure (5.2.16.3)
+ */
+class Acpi_affinity_x2apic : public Acpi_affinity
+{
+    public:
+        uint16  reserved1;
+        uint32  pxm;
+        uint32  x2apic_id;
+        uint32  flags;
+        uint32  clock_domain;
+        uint32  reserved2;
+};
+
+/*
+ * System Resource Affinity Table
+ */
+class Acpi_table_srat : public Acpi_table
+{
+    private:
+        INIT
+        static void parse_lapic (Acpi_affinity const *);
+
+        INIT
+        static void parse_mem (Acpi_affinity const *);
+
+        INIT
+        static void parse_x2apic (Acpi_affinity const *);
+
+        INIT
+        void parse_entry (Acpi_affinity::Type, void (*)(Acpi_affinity const *)) const;
+
+    public:
+        uint32          reserved1;
+        uint64          reserved2;
+        Acpi_affinity   affinity[];
+
+        INIT
+        void parse() const;
+};
+
+#pragma pack()
@@ -29,18 +29,23 @@
 class Buddy : public List<Buddy>
 {
     private:
+        /*
+         * Free-list link, stored in the first page of each free block
+         */
         class Block
         {
             public:
                 Block *         prev;
                 Block *         next;
-                unsigned short  ord;
-                unsigned short  tag;
+        };
 
-                enum {
-                    Used  = 0,
-                    Free  = 1
-                };
+        /*
+         * One byte of metadata per page: the order of the block starting
+         * at the page and whether it is free
+         */
+        enum {
+            Free  = 0x80,
+            Order = 0x7f
         };
 
         Spinlock        lock    { };
@@ -48,21 +53,38 @@ class Buddy : public List<Buddy>
         signed long     min_idx { 0 };
         mword           base    { 0 };
         mword           order   { 0 };
-        Block *         index   { nullptr };
+        uint8 *         index   { nullptr };
         Block *         head    { nullptr };
+        unsigned        node;
 
         static Buddy * list;
 
         ALWAYS_INLINE
         inline signed long block_to_index (Block *b)
         {
-            return b - index;
+            return page_to_index (reinterpret_cast<mword>(b));
         }
 
         ALWAYS_INLINE
         inline Block *index_to_block (signed long i)
         {
-            return index + i;
+            return reinterpret_cast<Block *>(index_to_page (i));
+        }
+
+        ALWAYS_INLINE
+        inline void dequeue (Block *b)
+        {
+            b->prev->next = b->next;
+            b->next->prev = b->prev;
+        }
+
+        ALWAYS_INLINE
+        inline void enqueue (Block *b, unsigned short ord)
+        {
+            Block *h = head + ord;
+            b->prev = h;
+            b->next = h->next;
+            b->next->prev = h->next = b;
         }
 
         ALWAYS_INLINE
@@ -100,7 +122,7 @@ class Buddy : public List<Buddy>
         static Buddy allocator;
 
         INIT
-        Buddy (mword phys, mword virt, mword f_addr, size_t size);
+        Buddy (mword phys, mword virt, mword f_addr, size_t size, unsigned = 0);
 
         static void *alloc (unsigned short ord, Quota &quota, Fill fill);
 
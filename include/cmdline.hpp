@@ -52,6 +52,8 @@ class Cmdline
         static bool logmem;
         static bool fpu_lazy;
         static bool hlt;
+        static bool arena;
+        static bool rcu_chunk;
 
         INIT
         static void init (char const *);
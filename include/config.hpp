@@ -36,7 +36,7 @@
 #define NUM_GSI         192
 #define NUM_LVT         6
 #define NUM_MSI         1
-#define NUM_IPI         4
+#define NUM_IPI         5
 
 #define SPN_SCH         0
 #define SPN_HLP         1
@@ -53,5 +53,10 @@
 #define VM_EXIT_NPT      (NUM_VMI - 4)
 #define VM_EXIT_NOSUPP   (NUM_VMI - 5)
 
+#define HALT_POLL_MIN_US   10
+#define HALT_POLL_MAX_US   200
+
+#define IOMMU_LAZY_BATCH   32
+
 #define HELPING_LOOP_TOO_LONG_CHECK        100
 #define HELPING_LOOP_LIMIT_RATE_MESSAGE_MS 10'000
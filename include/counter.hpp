@@ -38,6 +38,13 @@ class Counter
         static unsigned vtlb_flush      CPULOCAL;
         static unsigned schedule        CPULOCAL;
         static unsigned helping         CPULOCAL;
+        static unsigned rcu_exp         CPULOCAL;
+        static unsigned rcu_exp_oom     CPULOCAL;
+        static unsigned rcu_batches     CPULOCAL;
+        static unsigned rcu_elems       CPULOCAL;
+        static unsigned rcu_max_len     CPULOCAL;
+        static uint64   rcu_cycles      CPULOCAL;
+        static uint64   rcu_max_cycles  CPULOCAL;
         static uint64   cycles_idle     CPULOCAL;
 
         static void dump();
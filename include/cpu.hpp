@@ -140,6 +140,7 @@ class Cpu
         {
             EFER_LME        = 1UL << 8,         // 0x100
             EFER_LMA        = 1UL << 10,        // 0x400
+            EFER_NXE        = 1UL << 11,        // 0x800
             EFER_SVME       = 1UL << 12,        // 0x1000
         };
 
@@ -173,6 +174,7 @@ class Cpu
         static uint8    package[NUM_CPU];
         static uint8    core[NUM_CPU];
         static uint8    thread[NUM_CPU];
+        static uint8    node[NUM_CPU];
 
         static uint8    platform[NUM_CPU];
         static uint8    family[NUM_CPU];
@@ -0,0 +1,86 @@
+/*
+ * Guest-Physical Dirty Log
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "atomic.hpp"
+#include "buddy.hpp"
+
+/*
+ * Summary of guest-physical regions written since they were last harvested.
+ * Fed from the PML buffers of the vCPUs, it lets the dirty-bit scan skip
+ * regions that cannot contain dirty pages. Regions beyond the summary are
+ * always scanned.
+ */
+class Dirty_log
+{
+    private:
+        enum { BITS = sizeof (mword) * 8 };
+
+        mword region[PAGE_SIZE / sizeof (mword)];
+
+    public:
+        enum { REGION_BITS = 21 };
+
+        ALWAYS_INLINE
+        static inline uint64 limit() { return static_cast<uint64>(PAGE_SIZE * 8) << REGION_BITS; }
+
+        ALWAYS_INLINE
+        inline void mark (uint64 gpa)
+        {
+            if (gpa >= limit())
+                return;
+
+            mword r = static_cast<mword>(gpa >> REGION_BITS);
+
+            if (!(region[r / BITS] & 1UL << r % BITS))
+                Atomic::test_set_bit (region[r / BITS], r % BITS);
+        }
+
+        ALWAYS_INLINE
+        inline void mark_all()
+        {
+            for (unsigned i = 0; i < sizeof (region) / sizeof (*region); i++)
+                region[i] = ~0UL;
+        }
+
+        ALWAYS_INLINE
+        inline bool test (uint64 gpa) const
+        {
+            if (gpa >= limit())
+                return true;
+
+            mword r = static_cast<mword>(gpa >> REGION_BITS);
+
+            return region[r / BITS] & 1UL << r % BITS;
+        }
+
+        ALWAYS_INLINE
+        inline bool test_clear (uint64 gpa)
+        {
+            if (gpa >= limit())
+                return true;
+
+            mword r = static_cast<mword>(gpa >> REGION_BITS);
+
+            return Atomic::test_clr_bit (region[r / BITS], r % BITS);
+        }
+
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_1); }
+
+        ALWAYS_INLINE
+        static inline void destroy (Dirty_log *obj, Quota &quota) { obj->~Dirty_log(); Buddy::allocator.free (reinterpret_cast<mword>(obj), quota); }
+};
@@ -29,7 +29,9 @@
 #include "queue.hpp"
 #include "regs.hpp"
 #include "sc.hpp"
+#include "timeout_budget.hpp"
 #include "timeout_hypercall.hpp"
+#include "vm_profile.hpp"
 #include "tss.hpp"
 #include "si.hpp"
 #include "cmdline.hpp"
@@ -40,6 +42,7 @@ class Utcb;
 class Sm;
 class Pt;
 class Sys_ec_ctrl;
+class Vm_policy;
 
 class Ec : public Kobject, public Refcount, public Queue<Sc>
 {
@@ -73,11 +76,24 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
 
         Sm *         xcpu_sm { };
         Pt *         pt_oom  { };
+        Vm_policy *  policy  { };
+        Vm_profile * profile { };
 
         uint64      tsc  { 0 };
         uint64      time { 0 };
         uint64      time_m { 0 };
 
+        uint64      pause_exits  { 0 };
+        uint64      pause_yields { 0 };
+
+        mword       fault_ord { 0 };
+
+        uint64      exit_tsc    { 0 };
+        mword       exit_reason { 0 };
+
+        uint64      halt_window { 0 };
+        uint64      halt_tsc    { 0 };
+
         static uint64 killed_time[NUM_CPU];
 
         static Sm * auth_suspend;
@@ -110,6 +126,10 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         NORETURN
         static inline void svm_invlpg();
 
+        static inline void svm_policy (unsigned);
+
+        static inline void svm_pause();
+
         NORETURN
         static inline void vmx_exception();
 
@@ -122,6 +142,19 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         NORETURN
         static inline void vmx_cr();
 
+        static inline void vmx_policy (unsigned);
+
+        static inline void vmx_pause();
+
+        static inline void vmx_hlt();
+
+        NORETURN
+        static void pause_yield (void (*)());
+
+        static bool halt_poll();
+
+        void halt_adapt();
+
         static bool fixup (mword &);
 
         NOINLINE
@@ -235,6 +268,10 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         static Ec *fpowner CPULOCAL;
         static Ec *ec_idle CPULOCAL;
 
+        enum { HALT_POLL_HIT, HALT_POLL_MISS, HALT_POLL_STATS };
+
+        static unsigned halt_stat[NUM_CPU][HALT_POLL_STATS];
+
         Ec (Pd *, void (*)(), unsigned);
         Ec (Pd *, mword, Pd *, void (*)(), unsigned, unsigned, mword, mword, Pt *);
         Ec (Pd *, Pd *, void (*f)(), unsigned, Ec *);
@@ -282,6 +319,10 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
 
             check_hazard_tsc_aux();
 
+            // XSV guest state stays live across VM exits until host code runs
+            if (current->vcpu() && !vcpu())
+                Fpu::State_xsv::make_current (Fpu::hst_xsv);
+
             uint64 const t = rdtsc();
 
             current->time += t - current->tsc;
@@ -555,6 +596,29 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         ALWAYS_INLINE
         void inline measured() { time_m = time; }
 
+        ALWAYS_INLINE
+        inline void profile_exit (mword reason)
+        {
+            if (EXPECT_TRUE (!profile))
+                return;
+
+            exit_tsc    = rdtsc();
+            exit_reason = reason;
+
+            profile->exit (reason);
+        }
+
+        ALWAYS_INLINE
+        inline void profile_entry()
+        {
+            if (EXPECT_TRUE (!profile || !exit_tsc))
+                return;
+
+            profile->enter (exit_reason, rdtsc() - exit_tsc);
+
+            exit_tsc = 0;
+        }
+
         ALWAYS_INLINE
         inline bool vcpu()
         {
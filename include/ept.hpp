@@ -35,6 +35,8 @@ class Ept : public Pte<Ept, uint64, 4, 9, false, false>
             EPT_X   = 1UL << 2,
             EPT_I   = 1UL << 6,
             EPT_S   = 1UL << 7,
+            EPT_A   = 1UL << 8,
+            EPT_D   = 1UL << 9,
 
             PTE_P   = EPT_R | EPT_W | EPT_X,
             PTE_N   = EPT_R | EPT_W | EPT_X,
@@ -49,11 +51,15 @@ class Ept : public Pte<Ept, uint64, 4, 9, false, false>
         ALWAYS_INLINE
         static inline mword hw_attr (mword a, mword t) { return a ? t << 3 | a | EPT_I | EPT_R : 0; }
 
+        /* The mapping order lives in ignored bits 52-55, clear of the A/D bits */
         ALWAYS_INLINE
-        inline mword order() const { return PAGE_BITS + (static_cast<mword>(val) >> 8 & 0xf); }
+        inline mword order() const { return PAGE_BITS + static_cast<mword>(val >> 52 & 0xf); }
 
         ALWAYS_INLINE
-        static inline mword order (mword o) { return o << 8; }
+        static inline uint64 order (mword o) { return static_cast<uint64>(o) << 52; }
+
+        ALWAYS_INLINE
+        inline Paddr addr() const { return static_cast<Paddr>(val & ((1ULL << 52) - 1)) & ~((1UL << order()) - 1); }
 
         ALWAYS_INLINE
         inline void flush()
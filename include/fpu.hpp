@@ -120,24 +120,50 @@ class Fpu
             uint64_t    xss             { 0 };
 
             /*
-             * Switch XSAVE state between guest/host
+             * Make XSAVE state live, skipping registers that hold it already
              *
              * VMM-provided guest state was sanitized by constrain_* functions below
              *
-             * @param o     Old live state
              * @param n     New live state
              */
             ALWAYS_INLINE
-            static inline void make_current (State_xsv const &o, State_xsv const &n)
+            static inline void make_current (State_xsv const &n)
             {
                 if (!Cpu::feature (Cpu::FEAT_XSAVE))
                     return;
 
-                if (EXPECT_FALSE (o.xcr != n.xcr))
-                    set_xcr (0, n.xcr);
+                State_xsv &c = cur_xsv[Cpu::id];
 
-                if (EXPECT_FALSE (o.xss != n.xss))
-                    Msr::write (Msr::IA32_XSS, n.xss);
+                if (EXPECT_TRUE (c.xcr == n.xcr && c.xss == n.xss))
+                    return;
+
+                if (c.xcr != n.xcr)
+                    set_xcr (0, c.xcr = n.xcr);
+
+                if (c.xss != n.xss)
+                    Msr::write (Msr::IA32_XSS, c.xss = n.xss);
+
+                xsv_stat[Cpu::id][XSV_SWITCHED]++;
+            }
+
+            /*
+             * Make guest XSAVE state live before VM entry
+             *
+             * Counts an elision if the state differs from the host state
+             * and is still live from the last VM exit
+             *
+             * @param n     Guest state
+             */
+            ALWAYS_INLINE
+            static inline void make_guest (State_xsv const &n)
+            {
+                State_xsv const &c = cur_xsv[Cpu::id];
+
+                if (c.xcr == n.xcr && c.xss == n.xss && (n.xcr != hst_xsv.xcr || n.xss != hst_xsv.xss))
+                    if (Cpu::feature (Cpu::FEAT_XSAVE))
+                        xsv_stat[Cpu::id][XSV_ELIDED]++;
+
+                make_current (n);
             }
 
             /*
@@ -180,6 +206,13 @@ class Fpu
 
         static State_xsv hst_xsv CPULOCAL;
 
+        // XSAVE state live on each CPU, host state is restored lazily
+        static State_xsv cur_xsv[NUM_CPU];
+
+        enum { XSV_SWITCHED, XSV_ELIDED, XSV_STATS };
+
+        static unsigned xsv_stat[NUM_CPU][XSV_STATS];
+
         // XSAVE area format: XSAVES/compact (true), XSAVE/standard (false)
         static inline constinit bool compact { false };
 
@@ -28,7 +28,7 @@
 class Hip_cpu
 {
     public:
-        uint8   flags;
+        uint8   flags;      // 0: online, 1: P-core, 2: E-core, 4-7: NUMA node
         uint8   thread;
         uint8   core;
         uint8   package;
@@ -51,7 +51,9 @@ class Hip_mem
             ACPI_XSDT   = -4u,
             MB2_FB      = -5u,
             HYP_LOG     = -6u,
-            SYSTAB      = -7u
+            SYSTAB      = -7u,
+            NUMA_MEM    = -8u,  // aux: node
+            NUMA_NODE   = -9u   // aux: node, addr: distance to node i in byte i, size: proximity domain
         };
 
         uint64  addr;
@@ -88,6 +90,7 @@ class Hip
             FEAT_IOMMU  = 1U << 0,
             FEAT_VMX    = 1U << 1,
             FEAT_SVM    = 1U << 2,
+            FEAT_PINT   = 1U << 3,
         };
 
         static mword root_addr;
@@ -148,10 +151,13 @@ class Hip
         static void add_mhv (Hip_mem *&);
 
         INIT
-        static void add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, bool);
+        static void add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, bool, unsigned);
 
         INIT
-        static void _add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, Hip_mem const &);
+        static void _add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, Hip_mem const &, uint64 const, uint64 const, unsigned);
+
+        INIT
+        static void add_numa (Hip_mem *&);
 
         template <typename T>
         INIT
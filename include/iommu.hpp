@@ -18,6 +18,8 @@
 #pragma once
 
 #include "lapic.hpp"
+#include "lock_guard.hpp"
+#include "spinlock.hpp"
 #include "types.hpp"
 #include "x86.hpp"
 #include "stdio.hpp"
@@ -27,6 +29,80 @@ class Pd;
 namespace Iommu
 {
     class Interface;
+    class Ranges;
+    struct Flush;
+};
+
+/*
+ * DMA ranges, in pages, whose translations a flush has to invalidate. A
+ * flush without ranges covers the whole domain.
+ */
+struct Iommu::Flush
+{
+    enum { MAX = 8 };
+
+    struct Range
+    {
+        mword   base;
+        mword   ord;
+    };
+
+    Range       range[MAX];
+    unsigned    count { 0 };
+};
+
+/*
+ * DMA ranges of a PD whose IOMMU translations became stale since its last
+ * flush, as recorded by Space_mem::update. Contained ranges are dropped and
+ * buddies merged; beyond MAX ranges the next flush covers the whole domain.
+ */
+class Iommu::Ranges
+{
+    private:
+        Spinlock    lock     { };
+        Flush       pending  { };
+        bool        overflow { false };
+
+    public:
+        inline void add (mword base, mword ord)
+        {
+            Lock_guard <Spinlock> guard (lock);
+
+            for (unsigned i = 0; i < pending.count; i++) {
+
+                Flush::Range &r = pending.range[i];
+
+                if (r.ord >= ord && !((r.base ^ base) >> r.ord))
+                    return;
+
+                if (r.ord == ord && (r.base ^ base) == 1UL << ord) {
+                    r.base &= ~(1UL << ord);
+                    r.ord++;
+                    return;
+                }
+            }
+
+            if (pending.count < Flush::MAX)
+                pending.range[pending.count++] = { base, ord };
+            else
+                overflow = true;
+        }
+
+        ALWAYS_INLINE
+        inline bool full() const { return overflow || pending.count == Flush::MAX; }
+
+        inline void take (Flush &f)
+        {
+            Lock_guard <Spinlock> guard (lock);
+
+            f.count = overflow ? 0 : pending.count;
+
+            for (unsigned i = 0; i < f.count; i++)
+                f.range[i] = pending.range[i];
+
+            pending.count = 0;
+            overflow      = false;
+        }
 };
 
 class Iommu::Interface
@@ -94,5 +170,5 @@ class Iommu::Interface
 
         static void set_irt (unsigned, unsigned, unsigned, unsigned, unsigned);
         static void release (uint16, Pd *);
-        static void flush_pgt(uint16, Pd &);
+        static void flush_pgt(uint16, Pd &, Flush const &);
 };
@@ -81,6 +81,9 @@ class Iommu::Amd : public Iommu::Interface, public List<Amd>
 
         uint64            cmd_base   { 0 };
         uint64            event_base { 0 };
+        uint64            cmd_tail   { 0 };
+        uint64            cmd_seq    { 0 };
+        alignas(8) uint64 cmd_done   { 0 };
 
         Spinlock          lock { };
 
@@ -176,12 +179,25 @@ class Iommu::Amd : public Iommu::Interface, public List<Amd>
 
         void fault_handler();
 
+        /* queues a command, the hardware sees it with the next cmd_wait */
+        ALWAYS_INLINE
+        inline void cmd_submit (uint64 const lo, uint64 const hi)
+        {
+            uint64 *cmd = reinterpret_cast<uint64 *>(cmd_base + cmd_tail);
+            cmd[0] = lo;
+            cmd[1] = hi;
+
+            cmd_tail = (cmd_tail + 16) % (1ull << (12 + CMD_ORDER));
+        }
+
+        void cmd_wait();
+
         ALWAYS_INLINE
         void flush_dte(unsigned rid, bool wait) { flush(rid, 2, wait); }
         ALWAYS_INLINE
         void flush_irt(unsigned rid, bool wait) { flush(rid, 5, wait); }
 
-        void flush_pgt(Pd &);
+        void flush_pgt(Pd &, Flush const &);
         void flush(unsigned, unsigned, bool);
 
         void release(Pd *, uint16);
@@ -214,7 +230,7 @@ class Iommu::Amd : public Iommu::Interface, public List<Amd>
                 iommu->release(pd, rid);
         }
 
-        static void flush_pgt(uint16, Pd &);
+        static void flush_pgt(uint16, Pd &, Flush const &);
 
         static void vector (unsigned const vector)
         {
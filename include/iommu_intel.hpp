@@ -40,6 +40,7 @@ class Dmar_qi
         {
             FLUSH_GLOBAL = 0x1,
             FLUSH_BY_DID = 0x2,
+            FLUSH_BY_PAGE = 0x3,
         };
 };
 
@@ -53,6 +54,16 @@ class Dmar_qi_tlb : public Dmar_qi
 {
     public:
         Dmar_qi_tlb(Mode mode, uint64 did) : Dmar_qi (0x2ULL | (uint64(mode) << 4) | ((did & 0xffffULL) << 16)) {}
+
+        /* Page-selective within the domain, 2^am pages at the naturally aligned addr */
+        Dmar_qi_tlb(uint64 did, uint64 addr, unsigned am) : Dmar_qi (0x2ULL | (uint64(FLUSH_BY_PAGE) << 4) | ((did & 0xffffULL) << 16), addr | am) {}
+};
+
+class Dmar_qi_wait : public Dmar_qi
+{
+    public:
+        /* Status write of data to addr once all earlier descriptors completed */
+        Dmar_qi_wait(uint32 data, uint64 addr) : Dmar_qi (0x5ULL | 1ULL << 5 | uint64(data) << 32, addr) {}
 };
 
 class Dmar_qi_iec : public Dmar_qi
@@ -107,6 +118,8 @@ class Dmar : public Iommu::Interface, public List<Dmar>
         uint64              ecap { 0 };
         Dmar_qi *           invq;
         unsigned            invq_idx;
+        uint32              invq_seq { 0 };
+        uint32              invq_done { 0 };
         Spinlock            lock { };
 
         static Dmar_ctx *   ctx;
@@ -162,6 +175,12 @@ class Dmar : public Iommu::Interface, public List<Dmar>
         ALWAYS_INLINE
         inline bool cm() const { return cap & (1 << 7); }
 
+        ALWAYS_INLINE
+        inline bool psi() const { return cap & (1ULL << 39); }
+
+        ALWAYS_INLINE
+        inline mword mamv() const { return static_cast<mword>(cap >> 48 & 0x3f); }
+
         ALWAYS_INLINE
         inline mword iro() const { return static_cast<mword>(ecap >> 4 & 0x3ff0) + reg_base; }
 
@@ -218,21 +237,25 @@ class Dmar : public Iommu::Interface, public List<Dmar>
               trace(TRACE_IOMMU, "timeout - iommu command");
         }
 
+        /* Descriptors are only queued here, qi_wait hands them over in one go */
         ALWAYS_INLINE
         inline void qi_submit (Dmar_qi const &q)
         {
             invq[invq_idx] = q;
             invq_idx = (invq_idx + 1) % cnt;
-            write<uint64>(REG_IQT, invq_idx << 4);
         };
 
         ALWAYS_INLINE
         inline void qi_wait()
         {
-            uint64 v = read<uint64>(REG_IQT);
+            uint32 const seq = ++invq_seq;
+
+            qi_submit (Dmar_qi_wait (seq, Buddy::ptr_to_phys (&invq_done)));
+
+            write<uint64>(REG_IQT, invq_idx << 4);
 
             if (!Lapic::pause_loop_until(500, [&] {
-              return v != read<uint64>(REG_IQH);
+              return ACCESS_ONCE (invq_done) != seq;
             }))
               trace(TRACE_IOMMU, "timeout - iommu qi_wait");
         }
@@ -260,8 +283,9 @@ class Dmar : public Iommu::Interface, public List<Dmar>
             }
         }
 
-        void fault_handler();
+        void flush_tlb (uint64, Iommu::Flush const &);
 
+        void fault_handler();
 
         ALWAYS_INLINE
         inline void init()
@@ -327,7 +351,7 @@ class Dmar : public Iommu::Interface, public List<Dmar>
         void assign (uint16, Pd *) override;
         static void release (uint16, Pd *);
 
-        static void flush_pgt(uint16, Pd &);
+        static void flush_pgt(uint16, Pd &, Iommu::Flush const &);
 
         static void vector (unsigned);
 
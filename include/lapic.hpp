@@ -126,6 +126,17 @@ class Lapic
             return read (LAPIC_LVR) >> 16 & 0xff;
         }
 
+        /* Any interrupt requested but not yet delivered */
+        ALWAYS_INLINE
+        static inline bool pending()
+        {
+            for (unsigned i = 0; i < 8; i++)
+                if (read (Register (LAPIC_IRR + i)))
+                    return true;
+
+            return false;
+        }
+
         ALWAYS_INLINE
         static inline void eoi()
         {
@@ -143,6 +154,15 @@ class Lapic
                 Msr::write (Msr::IA32_TSC_DEADLINE, tsc);
         }
 
+        ALWAYS_INLINE
+        static inline void clr_timer()
+        {
+            if (freq_bus)
+                write (LAPIC_TMR_ICR, 0);
+            else
+                Msr::write (Msr::IA32_TSC_DEADLINE, 0);
+        }
+
         ALWAYS_INLINE
         static inline unsigned get_timer()
         {
@@ -0,0 +1,102 @@
+/*
+ * Non-Uniform Memory Access (NUMA) topology
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "compiler.hpp"
+#include "types.hpp"
+
+class Numa
+{
+    public:
+        enum
+        {
+            MAX_NODES   = 8,
+            MAX_RANGES  = 32,
+            MAX_APICS   = 256,
+
+            LOCAL       = 10,
+            REMOTE      = 20,
+
+            ANY         = ~0U
+        };
+
+    private:
+        class Range
+        {
+            public:
+                uint64  base;
+                uint64  size;
+                unsigned node;
+        };
+
+        static Range    range[MAX_RANGES];
+        static uint32   domain[MAX_NODES];
+        static uint8    apic[MAX_APICS];
+
+        INIT
+        static unsigned node (uint32);
+
+    public:
+        static unsigned nodes;
+        static unsigned ranges;
+
+        static uint8    dist[MAX_NODES][MAX_NODES];
+        static uint8    order[MAX_NODES][MAX_NODES];
+
+        INIT
+        static void add_mem (uint32, uint64, uint64);
+
+        INIT
+        static void add_cpu (uint32, uint32);
+
+        INIT
+        static void set_distance (uint32, uint32, uint8);
+
+        INIT
+        static void setup();
+
+        INIT
+        static unsigned node_of_phys (uint64);
+
+        static unsigned node_of_apic (unsigned a)
+        {
+            return a < MAX_APICS ? apic[a] : 0;
+        }
+
+        static uint32 proximity (unsigned n)
+        {
+            return n < nodes ? domain[n] : 0;
+        }
+
+        /*
+         * Call fn for every memory range of node n, or for all ranges if n
+         * is ANY. Without SRAT all memory belongs to node 0.
+         */
+        template <typename T>
+        INIT
+        static void for_each_range (unsigned n, T const fn)
+        {
+            if (!ranges) {
+                if (n == ANY || n == 0)
+                    fn (0, ~0ULL, 0U);
+                return;
+            }
+
+            for (unsigned i = 0; i < ranges; i++)
+                if (n == ANY || range[i].node == n)
+                    fn (range[i].base, range[i].base + range[i].size, range[i].node);
+        }
+};
@@ -27,11 +27,18 @@
 #include "space_obj.hpp"
 #include "space_pio.hpp"
 
+class Vtlb_track;
+
+class Sm;
+
 class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio, public Space_obj
 {
     private:
         static Slab_cache cache;
 
+        Pd (Pd const &);
+        Pd &operator = (Pd const &);
+
         WARN_UNUSED_RESULT
         mword clamp (mword,   mword &, mword, mword);
 
@@ -70,11 +77,47 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
 
         static_assert (sizeof(rids_u) * 8 >= sizeof(rids) / sizeof(rids[0]), "rids_u too small");
 
+        /* fires the deferred IOMMU flush of a lazy PD after an RCU grace period */
+        class Dma_timer : public Rcu_elem
+        {
+            private:
+                Dma_timer (Dma_timer const &);
+                Dma_timer &operator = (Dma_timer const &);
+
+            public:
+                Pd * const pd;
+
+                explicit Dma_timer (Pd *p, void (*f)(Rcu_elem *)) : Rcu_elem (f), pd (p) {}
+        };
+
+        static void dma_expire (Rcu_elem *);
+
+        Spinlock  dma_lock   { };
+        Spinlock  dma_flush  { };
+        bool      dma_lazy   { false };
+        bool      dma_armed  { false };
+        unsigned  dma_batch  { 0 };         // deferred revokes not yet flushed
+        uint64    dma_gen    { 0 };         // flushes started
+        uint64    dma_sm_gen { 0 };         // flush that releases dma_sm
+        Sm *      dma_sm     { nullptr };
+        Dma_timer dma_timer { this, dma_expire };
+
+        static Pd *dma_pend[NUM_CPU];
+
+        bool defer_pgt();
+
+        static bool track_dma (Pd *);
+        static void flush_dma (Pd ** = nullptr);
+
     public:
         static Pd *current CPULOCAL_HOT;
         static Pd kern, root;
 
-        Quota quota { };
+        Quota quota;
+
+        unsigned vcpus { 0 };   // vCPUs alive
+
+        Vtlb_track * vtlb_track { nullptr };    // guest page tables seen by vTLB walks
 
         Slab_cache pt_cache;
         Slab_cache mdb_cache;
@@ -83,6 +126,8 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
         Slab_cache ec_cache;
         Slab_cache fpu_cache;
 
+        static Slab_cache pt_arena, mdb_arena, sm_arena, sc_arena, ec_arena, fpu_arena;
+
         INIT
         Pd (Pd *);
         ~Pd();
@@ -141,14 +186,20 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
         template <typename>
         void revoke (mword, mword, mword, bool, bool);
 
-        void xfer_items (Pd *, Crd, Crd, Xfer *, Xfer *, unsigned long);
+        template <typename>
+        void downgrade (Mdb *, mword);
+
+        void xfer_items (Pd *, Crd, Crd, Xfer *, Xfer *, unsigned long, mword = 0);
 
         void xlt_crd (Pd *, Crd, Crd &);
+        void fault_around (Pd *, Crd &, mword, mword);
         void del_crd (Pd *, Crd, Crd &, mword = 0, mword = 0);
-        void rev_crd (Crd, bool, bool, bool);
+        void rev_crd (Crd, bool, bool, bool, Pd ** = nullptr);
 
         void assign_rid(uint16 r);
 
+        mword slab_pages();
+
         template<typename FUNC>
         void release_rid(FUNC const &fn)
         {
@@ -176,13 +227,11 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
         }
 
 
-        void flush_pgt()
-        {
-            for (unsigned i = 0; i < sizeof(rids) / sizeof(rids[0]); i++) {
-                if (rids_u & (1U << i))
-                    Iommu::Interface::flush_pgt(rids[i], *this);
-            }
-        }
+        void flush_pgt();
+
+        void lazy_dma (bool);
+
+        bool defer_sm (Sm *);
 
 
         ALWAYS_INLINE
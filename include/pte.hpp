@@ -84,6 +84,7 @@ class Pte
             ERR_P   = 1UL << 0,
             ERR_W   = 1UL << 1,
             ERR_U   = 1UL << 2,
+            ERR_I   = 1UL << 4,
         };
 
         enum Type
@@ -108,5 +109,7 @@ class Pte
 
         void clear (Quota &quota, bool (*) (Paddr, mword, unsigned) = nullptr, bool (*) (unsigned, mword) = nullptr);
 
+        unsigned long collect (E, E, unsigned long, mword *, unsigned long = 0);
+
         bool check(Quota_guard &qg, mword o) { return qg.check(o / (4096 / sizeof(E)) + L); }
 };
@@ -17,7 +17,11 @@
 
 #pragma once
 
+#include "atomic.hpp"
+#include "config.hpp"
+#include "cpu.hpp"
 #include "lock_guard.hpp"
+#include "memory.hpp"
 #include "util.hpp"
 
 class Buddy;
@@ -27,6 +31,20 @@ class Quota
     friend class Buddy;
 
     private:
+        /*
+         * Per-CPU credit of pages already charged to a quota. A quota with
+         * credit owns one page holding a cache line for each CPU.
+         */
+        class Credit
+        {
+            public:
+                enum { CHUNK = 16 };
+
+                mword   pages;
+        } ALIGNED(64);
+
+        static_assert (sizeof (Credit) * NUM_CPU <= PAGE_SIZE, "Credit exceeds page");
+
         Spinlock lock { };
 
         mword used;
@@ -35,19 +53,23 @@ class Quota
         mword upli;
         mword notr;
 
-    public:
+        mword objs;
 
-        static Quota init;
+        Credit *credit;
 
-        Quota () : used(0), over(0), upli(0), notr(0) { }
+        ALWAYS_INLINE
+        static inline mword pages (mword bytes) { return (bytes + PAGE_SIZE - 1) / PAGE_SIZE; }
 
-        void alloc(mword p)
+        ALWAYS_INLINE
+        inline Credit &local() { return credit[Cpu::id]; }
+
+        void charge (mword p)
         {
             Lock_guard <Spinlock> guard (lock);
             used += p;
         }
 
-        void free(mword p)
+        void uncharge (mword p)
         {
             Lock_guard <Spinlock> guard (lock);
 
@@ -61,7 +83,119 @@ class Quota
             used = 0;
         }
 
-        mword usage() { return used; }
+        void refill (Credit &, mword);
+        void drain (Quota &);
+
+        mword outstanding();
+
+        Quota (Quota const &);
+        Quota &operator = (Quota const &);
+
+    public:
+
+        static Quota init;
+
+        Quota () : used(0), over(0), upli(0), notr(0), objs(0), credit(nullptr) { }
+
+        /*
+         * A quota with per-CPU credit pre-charges pages in chunks, so that
+         * most alloc/free calls only touch state of the current CPU. The
+         * credit page is charged to the given quota, if any.
+         */
+        explicit Quota (Quota *);
+
+        void alloc(mword p)
+        {
+            if (!credit) {
+                charge (p);
+                return;
+            }
+
+            bool pre = Cpu::preempt_status();
+            if (pre)
+                Cpu::preempt_disable();
+
+            Credit &c = local();
+
+            if (EXPECT_TRUE (c.pages >= p))
+                c.pages -= p;
+            else
+                refill (c, p);
+
+            if (pre)
+                Cpu::preempt_enable();
+        }
+
+        void free(mword p)
+        {
+            if (!credit) {
+                uncharge (p);
+                return;
+            }
+
+            bool pre = Cpu::preempt_status();
+            if (pre)
+                Cpu::preempt_disable();
+
+            Credit &c = local();
+
+            c.pages += p;
+
+            // Return the surplus beyond one chunk lazily
+            if (EXPECT_FALSE (c.pages > 2 * Credit::CHUNK)) {
+                uncharge (c.pages - Credit::CHUNK);
+                c.pages = Credit::CHUNK;
+            }
+
+            if (pre)
+                Cpu::preempt_enable();
+        }
+
+        /*
+         * Objects from shared slab arenas are charged at byte granularity,
+         * the page usage covers the sum of all object bytes
+         */
+        void alloc_obj(mword s)
+        {
+            mword p;
+            {
+                Lock_guard <Spinlock> guard (lock);
+                p = pages (objs + s) - pages (objs);
+                objs += s;
+            }
+
+            if (p)
+                alloc (p);
+        }
+
+        void free_obj(mword s)
+        {
+            mword p;
+            {
+                Lock_guard <Spinlock> guard (lock);
+                mword o = objs > s ? objs - s : 0;
+                p = pages (objs) - pages (o);
+                objs = o;
+            }
+
+            if (p)
+                free (p);
+        }
+
+        mword objects() { return objs; }
+
+        /*
+         * Pages charged, minus the credit CPUs hold but have not consumed
+         */
+        mword usage()
+        {
+            if (!credit)
+                return used;
+
+            mword c = outstanding(), u = used;
+
+            return u > c ? u - c : 0;
+        }
 
         static void boot(Quota &kern, Quota &root)
         {
@@ -71,13 +205,17 @@ class Quota
 
         void free_up(Quota &to)
         {
-            mword l, u, o;
+            if (credit)
+                drain (to);
+
+            mword l, u, o, b;
             {
                 Lock_guard <Spinlock> guard (lock);
                 l = upli;
                 u = used;
                 o = over;
-                upli = over = used = 0;
+                b = objs;
+                upli = over = used = objs = 0;
             }
 
             Lock_guard <Spinlock> guard (to.lock);
@@ -85,6 +223,13 @@ class Quota
             to.upli += l;
             to.over += o;
 
+            // Arena bytes merge, drop pages charged twice by rounding up
+            if (b) {
+                mword r = pages (to.objs) + pages (b) - pages (to.objs + b);
+                to.objs += b;
+                to.used -= min (r, to.used);
+            }
+
             if (to.over && to.used) {
                 mword s = min (to.used, to.over);
                 to.used -= s;
@@ -98,6 +243,10 @@ class Quota
              if (free_space > upli)
                  return true;
 
+             // Charged pages including credit are an upper bound of the usage
+             if (used <= upli - free_space)
+                 return false;
+
              return usage() > upli - free_space;
         }
 
@@ -145,6 +294,8 @@ class Quota
 
         mword limit() { return upli; }
 
+        bool credited() const { return credit != nullptr; }
+
         void dump(void *, bool = true);
 };
 
@@ -155,12 +306,21 @@ class Quota_guard
         Quota q;
         Quota &r;
 
+        /*
+         * A quota with per-CPU credit is charged directly, there is no
+         * temporary quota to be merged back
+         */
+        bool const direct;
+
     public:
 
-        Quota_guard(Quota &ref) : q(), r(ref) { }
+        Quota_guard(Quota &ref) : q(), r(ref), direct(ref.credited()) { }
 
         bool check(mword req)
         {
+            if (direct)
+                return !r.hit_limit(req);
+
             if (!q.hit_limit(req))
                 return true;
 
@@ -172,7 +332,11 @@ class Quota_guard
             return r.transfer_to(q, req, false);
         }
 
-        operator Quota&() { return q; }
+        operator Quota&() { return direct ? r : q; }
 
-        ~Quota_guard() { q.free_up(r); }
+        ~Quota_guard()
+        {
+            if (!direct)
+                q.free_up(r);
+        }
 };
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "compiler.hpp"
+#include "config.hpp"
 #include "types.hpp"
 #include "atomic.hpp"
 
@@ -95,8 +96,23 @@ class Rcu_list
 class Rcu
 {
     private:
+        /*
+         * Extended quiescent state of a CPU (idle or executing a guest) and
+         * the last batch the CPU was accounted for, either by itself or by
+         * another CPU on its behalf while it was in the extended state
+         */
+        class Eqs
+        {
+            public:
+                mword idle;
+                mword seen;
+        } ALIGNED(64);
+
+        static Eqs   eqs[NUM_CPU];
+
         static mword count;
         static mword state;
+        static mword expedite_batch;
 
         static mword l_batch    CPULOCAL;
         static mword c_batch    CPULOCAL;
@@ -111,6 +127,12 @@ class Rcu
             RCU_PND = 1UL << 1,
         };
 
+        // Callbacks invoked at a time with the rcu_chunk option
+        enum { CHUNK = 64 };
+
+        // Longest wait for other CPUs to pass an expedited grace period
+        enum { EXPEDITE_MS = 1 };
+
         ALWAYS_INLINE
         static inline mword batch() { return state >> 2; }
 
@@ -120,6 +142,9 @@ class Rcu
         static void start_batch (State);
         static void invoke_batch();
 
+        static void report (unsigned, mword);
+        static void report_eqs();
+
     public:
         ALWAYS_INLINE
         static inline bool call (Rcu_elem *e) {
@@ -131,4 +156,19 @@ class Rcu
 
         static void quiet();
         static void update(bool = true);
+
+        static bool backlog() { return !done.empty(); }
+
+        static bool in_eqs (unsigned cpu) { return ACCESS_ONCE (eqs[cpu].idle); }
+
+        /*
+         * The CPU does not hold references to RCU-protected objects until
+         * eqs_exit, so grace periods need not wait for it
+         */
+        static void eqs_enter();
+        static void eqs_exit();
+
+        static bool expedite_pending() { return !complete (ACCESS_ONCE (expedite_batch)); }
+
+        static bool expedite();
 };
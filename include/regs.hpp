@@ -27,9 +27,11 @@
 #include "types.hpp"
 #include "fpu.hpp"
 
+class Pd;
 class Vmcb_state;
 class Vmcs_state;
 class Vtlb;
+class Vtlb_cache;
 
 class Sys_regs
 {
@@ -129,6 +131,10 @@ class Exc_regs : public Sys_regs
                 mword   nst_error;
                 uint8   nst_on;
                 uint8   fpu_on;
+                uint8   ple_on;
+                uint8   pause_vmm;
+                uint8   vtlb_lm;
+                uint8   pdpte_ld;
             };
         };
 
@@ -160,6 +166,9 @@ class Cpu_regs : public Exc_regs
             Vmcb_state *  vmcb_state;
         };
         Vtlb *  vtlb { };
+        Vtlb_cache * vtlb_cache { };
+        mword   vtlb_gen { };           // tracking generation of the last complete flush
+        Pd *    vtlb_pd { };            // owner of the vTLB, not Pd::current
 
         uint64  tsc_offset { };
         uint64  tsc_aux    { };
@@ -203,8 +212,11 @@ class Cpu_regs : public Exc_regs
 
         template <typename T> ALWAYS_INLINE inline Mode mode() const;
 
-        template <typename T> void tlb_flush (bool) const;
-        template <typename T> void tlb_flush (mword) const;
+        template <typename T> void tlb_flush (bool);
+        template <typename T> void tlb_flush (mword);
+        template <typename T> void tlb_flush_tag (bool) const;
+
+        template <typename T> void vtlb_load (mword);
 
         template <typename T> ALWAYS_INLINE inline mword cr0_set() const;
         template <typename T> ALWAYS_INLINE inline mword cr0_msk() const;
@@ -243,5 +255,12 @@ class Cpu_regs : public Exc_regs
 
         template <typename T> void write_efer (mword);
 
+        template <typename T> void load_pdpte();
+
+        mword  guest_efer() const;
+#ifdef __x86_64__
+        uint64 guest_pdpte (unsigned) const;
+#endif
+
         template <typename T> mword linear_address (mword) const;
 };
@@ -96,6 +96,8 @@ class Sc : public Kobject, public Refcount
         NORETURN
         static void schedule (bool = false, bool = true);
 
+        static bool boost (Pd const *);
+
         ALWAYS_INLINE
         static inline void *operator new (size_t, Pd &pd) { return pd.sc_cache.alloc(pd.quota); }
 
@@ -21,22 +21,63 @@
 #pragma once
 
 #include "buddy.hpp"
+#include "config.hpp"
 #include "initprio.hpp"
 
 class Slab;
 
 class Slab_cache
 {
+    friend class Slab;
+
     private:
+        /*
+         * Per-CPU array stack of free objects in front of a slab cache.
+         * A magazine is owned by the CPU it belongs to and is allocated
+         * on the first use of its cache on that CPU.
+         */
+        class Magazine
+        {
+            public:
+                enum { DEPTH = 12, BATCH = DEPTH / 2 };
+
+                mword           count;
+                void *          obj[DEPTH];
+        };
+
+        // Backing caches of magazine directories and magazines
+        static Slab_cache dirs, mags;
+
         Spinlock    lock { };
         Slab *      curr;
         Slab *      head;
+        Magazine ** dir;        // Per-CPU magazines, nullptr until first use
+        bool const  cached;     // Cache allocates magazines
+        mword       slabs;
 
         /*
          * Back end allocator
          */
         void grow(Quota &quota);
 
+        void *alloc_slab (Quota &quota);
+        void free_slab (void *ptr, Quota &quota);
+
+        /*
+         * Magazine exchange with the slab lists
+         */
+        void *refill (Magazine &, Quota &quota);
+        void flush (Magazine &, mword, Quota &quota);
+        void drain (Quota &quota);
+
+        Magazine *magazine (Quota &quota);
+
+        /*
+         * Magazines of caches owned by a PD are charged to it, those of
+         * static kernel caches to the kernel
+         */
+        Quota &mag_quota (Quota &quota);
+
         Slab_cache (const Slab_cache&);
         Slab_cache &operator = (Slab_cache const &);
 
@@ -45,8 +86,15 @@ class Slab_cache
         unsigned long buff; // Size of an element buffer (includes link field)
         unsigned long elem; // Number of elements
 
-        Slab_cache (unsigned long elem_size, unsigned elem_align);
-        ~Slab_cache () { assert (!head && !curr); }
+        Slab_cache * const arena;   // Shared arena used instead, if enabled
+
+        static Quota shared;        // Slab pages of all shared arenas
+
+        Slab_cache (unsigned long elem_size, unsigned elem_align, Slab_cache * = nullptr, bool = true);
+        ~Slab_cache ()
+        {
+            assert (!head && !curr && !dir);
+        }
 
         /*
          * Front end allocator
@@ -58,7 +106,15 @@ class Slab_cache
          */
         void free (void *ptr, Quota &quota);
 
+        /*
+         * Release all slabs, objects cached in magazines are returned first
+         */
         void free (Quota &quota);
+
+        ALWAYS_INLINE
+        inline mword pages() const { return slabs; }
+
+        bool owns (void *ptr) const;
 };
 
 class Slab
@@ -79,6 +135,7 @@ class Slab
         ALWAYS_INLINE
         static inline void destroy(Slab *slab, Quota &quota)
         {
+            slab->cache->slabs--;
             slab->~Slab();
             Buddy::allocator.free (reinterpret_cast<mword>(slab), quota);
         }
@@ -36,10 +36,7 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
             if (sm->del_ref()) {
                 Pd *pd = static_cast<Pd *>(static_cast<Space_obj *>(sm->space));
 
-                Slab *slab = reinterpret_cast<Slab *>(reinterpret_cast<mword>(sm) & ~PAGE_MASK);
-                assert (slab);
-                assert (slab->cache);
-                assert (slab->cache == &pd->sm_cache);
+                assert (pd->sm_cache.owns (sm));
 
                 destroy(sm, *pd);
             } else {
@@ -25,16 +25,22 @@
 #include "config.hpp"
 #include "cpu.hpp"
 #include "cpuset.hpp"
+#include "dirty.hpp"
 #include "dpt.hpp"
 #include "ept.hpp"
 #include "ipt.hpp"
 #include "hpt.hpp"
+#include "iommu.hpp"
 #include "space.hpp"
 
 class Pd;
 
 class Space_mem : public Space
 {
+    private:
+        Space_mem              (Space_mem const &);
+        Space_mem & operator = (Space_mem const &);
+
     public:
         Hpt loc[NUM_CPU];
         Hpt hpt { };
@@ -47,17 +53,20 @@ class Space_mem : public Space
             Hpt npt;
         };
 
-        enum { NO_PCID = 2, NO_DOMAIN_ID = 0, NO_ASID_ID = 0 };
+        enum { NO_PCID = 2, NO_DOMAIN_ID = 0 };
         mword did { NO_PCID };
-        mword asid { NO_ASID_ID };
 
         Cpuset cpus;
         Cpuset htlb;
         Cpuset gtlb;
 
+        Dirty_log * dirty   { };
+        bool        logging { };
+
+        Iommu::Ranges dma_stale { };
+
         static Bit_alloc<4096, NO_PCID> did_alloc;
         static Bit_alloc<1<<16, NO_DOMAIN_ID> dom_alloc;
-        static Bit_alloc<1<<15, NO_ASID_ID>   asid_alloc;
 
         mword const dom_id { NO_DOMAIN_ID };
 
@@ -72,7 +81,6 @@ class Space_mem : public Space
         {
             dom_alloc.release(dom_id);
             did_alloc.release(did);
-            asid_alloc.release(asid);
         }
 
         ALWAYS_INLINE
@@ -105,6 +113,8 @@ class Space_mem : public Space
 
         static void shootdown(Pd *);
 
+        unsigned long collect_dirty (uint64, unsigned long, mword *);
+
         void init (Quota &quota, unsigned);
 
         ALWAYS_INLINE
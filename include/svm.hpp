@@ -21,6 +21,7 @@
 #pragma once
 
 #include "queue.hpp"
+#include "tlb_tag.hpp"
 #include "utcb.hpp"
 #include "slab.hpp"
 
@@ -36,7 +37,9 @@ class Vmcb
                 uint32      intercept_dr;           // 0x4
                 uint32      intercept_exc;          // 0x8
                 uint32      intercept_cpu[2];       // 0xc
-                uint32      reserved1[11];          // 0x14
+                uint32      reserved1[10];          // 0x14
+                uint16      pause_threshold;        // 0x3c
+                uint16      pause_count;            // 0x3e
                 uint64      base_io;                // 0x40
                 uint64      base_msr;               // 0x48
                 uint64      tsc_offset;             // 0x50
@@ -53,6 +56,7 @@ class Vmcb
                 uint64      inj_control;            // 0xa8
                 uint64      npt_cr3;                // 0xb0
                 uint64      lbr;                    // 0xb8
+                uint32      clean;                  // 0xc0
             };
         };
 
@@ -75,7 +79,6 @@ union {
 };
 
         static Paddr        root        CPULOCAL;
-        static unsigned     asid_ctr    CPULOCAL;
         static uint32       svm_version CPULOCAL;
         static uint32       svm_feature CPULOCAL;
 
@@ -91,6 +94,7 @@ union {
             CPU_INIT        = 1ul << 3,
             CPU_VINTR       = 1ul << 4,
             CPU_INVD        = 1ul << 22,
+            CPU_PAUSE       = 1ul << 23,
             CPU_HLT         = 1ul << 24,
             CPU_INVLPG      = 1ul << 25,
             CPU_IO          = 1ul << 27,
@@ -98,6 +102,24 @@ union {
             CPU_SHUTDOWN    = 1ul << 31,
         };
 
+        enum Clean
+        {
+            CLEAN_I         = 1ul << 0,
+            CLEAN_IOPM      = 1ul << 1,
+            CLEAN_ASID      = 1ul << 2,
+            CLEAN_TPR       = 1ul << 3,
+            CLEAN_NP        = 1ul << 4,
+            CLEAN_CRX       = 1ul << 5,
+            CLEAN_DRX       = 1ul << 6,
+            CLEAN_DT        = 1ul << 7,
+            CLEAN_SEG       = 1ul << 8,
+            CLEAN_CR2       = 1ul << 9,
+            CLEAN_LBR       = 1ul << 10,
+        };
+
+        /* State groups whose every writer marks them dirty in Vmcb_state */
+        static uint32 const clean_tracked = CLEAN_IOPM | CLEAN_ASID | CLEAN_DRX | CLEAN_DT | CLEAN_SEG | CLEAN_CR2 | CLEAN_LBR;
+
         enum Ctrl1
         {
             CPU_VMLOAD      = 1ul << 2,
@@ -128,7 +150,7 @@ union {
 
         static void destroy(Vmcb &, Quota &);
 
-        Vmcb (Quota &quota, mword, mword, unsigned);
+        Vmcb (Quota &quota, mword, mword);
 
         ALWAYS_INLINE
         inline Vmcb(unsigned const id)
@@ -153,6 +175,9 @@ union {
         }
 
         static bool has_npt() { return Vmcb::svm_feature & 1; }
+        static bool has_clean() { return Vmcb::svm_feature & 1ul << 5; }
+        static bool has_pause_filter() { return Vmcb::svm_feature & 1ul << 10; }
+        static bool has_pause_threshold() { return Vmcb::svm_feature & 1ul << 12; }
         static bool has_urg() { return true; }
 
         static void init();
@@ -181,6 +206,36 @@ class Vmcb_state
 
         Vmcb & vmcb;
 
+        uint32 dirty { ~0U };
+
+        Tlb_tag<Vmcb> asid { };
+
+        ALWAYS_INLINE
+        inline void mark (uint32 groups) { dirty |= groups; }
+
+        /* Give the VMCB an ASID of this CPU unless it still has one */
+        ALWAYS_INLINE
+        inline void load_asid()
+        {
+            if (EXPECT_TRUE (asid.valid()))
+                return;
+
+            if (asid.assign())
+                vmcb.tlb_control = 1;
+
+            vmcb.asid = asid.id;
+
+            mark (Vmcb::CLEAN_ASID);
+        }
+
+        /* Tell the CPU which VMCB state is unchanged since the last VMRUN */
+        ALWAYS_INLINE
+        inline void prepare_vmrun()
+        {
+            vmcb.clean = Vmcb::has_clean() ? Vmcb::clean_tracked & ~dirty : 0;
+            dirty = 0;
+        }
+
         ALWAYS_INLINE
         static inline void *operator new (size_t, Quota &quota) { return cache.alloc(quota); }
 
@@ -206,7 +261,7 @@ class Vmcb_state
 
         static void flush_all_vmcb()
         {
-            queue.for_each([](auto &vmcb_state) { vmcb_state.vmcb.flush(); });
+            queue.for_each([](auto &vmcb_state) { vmcb_state.vmcb.flush(); vmcb_state.mark (~0U); });
         }
 
         static void destroy(Vmcb_state * const remove, Quota &quota)
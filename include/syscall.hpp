@@ -212,11 +212,45 @@ class Sys_ec_ctrl : public Sys_regs
         ALWAYS_INLINE
         inline Crd crd() const { return Crd (ARG_3); }
 
+        ALWAYS_INLINE
+        inline mword policy() const { return ARG_2; }
+
+        ALWAYS_INLINE
+        inline mword vector() const { return ARG_2; }
+
+        ALWAYS_INLINE
+        inline bool level() const { return ARG_3 & 1; }
+
+        ALWAYS_INLINE
+        inline unsigned ple_gap() const { return static_cast<unsigned>(ARG_2); }
+
+        ALWAYS_INLINE
+        inline unsigned ple_window() const { return static_cast<unsigned>(ARG_3); }
+
+        ALWAYS_INLINE
+        inline mword fault_ord() const { return ARG_2; }
+
+        ALWAYS_INLINE
+        inline mword first() const { return ARG_2; }
+
         inline void set_time (uint64 val)
         {
             ARG_2 = static_cast<mword>(val >> 32);
             ARG_3 = static_cast<mword>(val);
         }
+
+        inline void set_pause (mword exits, mword yields)
+        {
+            ARG_2 = exits;
+            ARG_3 = yields;
+        }
+
+        inline void set_absorbed (mword cpuid, mword rdtsc, mword rdmsr)
+        {
+            ARG_2 = cpuid;
+            ARG_3 = rdtsc;
+            ARG_4 = rdmsr;
+        }
 };
 
 class Sys_sc_ctrl : public Sys_regs
@@ -283,6 +317,24 @@ class Sys_pd_ctrl : public Sys_regs
         ALWAYS_INLINE
         inline unsigned dbg() const { return flags() & 0x2; }
 
+        ALWAYS_INLINE
+        inline bool dirty() const { return flags() & 0x1; }
+
+        ALWAYS_INLINE
+        inline bool lazy() const { return flags() & 0x4; }
+
+        ALWAYS_INLINE
+        inline bool lazy_on() const { return ARG_2; }
+
+        ALWAYS_INLINE
+        inline uint64 gpa() const { return static_cast<uint64>(ARG_2) << PAGE_BITS; }
+
+        ALWAYS_INLINE
+        inline unsigned long pages() const { return ARG_3; }
+
+        ALWAYS_INLINE
+        inline void set_dirty (mword n) { ARG_2 = n; }
+
         ALWAYS_INLINE
         inline unsigned long dst() const { return ARG_2; }
 
@@ -290,10 +342,11 @@ class Sys_pd_ctrl : public Sys_regs
         inline unsigned long tra() const { return ARG_3; }
 
         ALWAYS_INLINE
-        inline void dump (mword l, mword u)
+        inline void dump (mword l, mword u, mword s)
         {
             ARG_2 = l;
             ARG_3 = u;
+            ARG_4 = s;
         }
 };
 
@@ -28,6 +28,11 @@ class Timeout
 
         virtual void trigger() = 0;
 
+        /* Expiry is enforced by other means, the LAPIC timer may lag behind */
+        virtual uint64 slack() const { return 0; }
+
+        static void arm();
+
         Timeout(const Timeout&);
         Timeout &operator = (Timeout const &);
 
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include "config.hpp"
+#include "cpu.hpp"
 #include "timeout.hpp"
 
 class Timeout_budget : public Timeout
@@ -24,6 +26,17 @@ class Timeout_budget : public Timeout
     private:
         void trigger();
 
+        uint64 slack() const;
+
     public:
         static Timeout_budget budget CPULOCAL;
+
+        /* Budget enforced by the VMX-preemption timer while a vCPU SC runs */
+        static bool guest[NUM_CPU];
+
+        /* LAPIC backstop delay behind the VMX-preemption timer */
+        static unsigned const BACKSTOP_US = 50;
+
+        ALWAYS_INLINE
+        inline uint64 deadline() const { return time; }
 };
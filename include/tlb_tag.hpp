@@ -0,0 +1,81 @@
+/*
+ * Guest TLB Tags (VPID/ASID)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "config.hpp"
+#include "cpu.hpp"
+
+/*
+ * Tag of a vCPU in the tagged guest TLB of the CPU it runs on. Each CPU
+ * hands out its tags in generations. When it runs out, it starts a new
+ * generation, after which the caller must flush the guest TLB entries of all
+ * tags once. Dropping a tag gives the vCPU a fresh one on its next entry,
+ * which is a flush of its guest TLB entries that costs no invalidation.
+ */
+template <typename T>
+class Tlb_tag
+{
+    private:
+        static uint64   generation[NUM_CPU];
+        static unsigned last[NUM_CPU];
+
+        uint64          gen { 0 };
+        uint16          cpu { 0 };
+
+    public:
+        static unsigned max;
+
+        unsigned        id  { 0 };
+
+        ALWAYS_INLINE
+        inline bool valid() const { return id && cpu == Cpu::id && gen == generation[Cpu::id]; }
+
+        ALWAYS_INLINE
+        inline void drop() { id = 0; }
+
+        /*
+         * Drop all tags of the current CPU. The tags handed out next were
+         * not in use since the last rollover, so this needs no invalidation.
+         */
+        ALWAYS_INLINE
+        static inline void drop_all()
+        {
+            if (generation[Cpu::id])
+                generation[Cpu::id]++;
+        }
+
+        /* Assign a new tag on the current CPU, returns true on rollover */
+        ALWAYS_INLINE
+        inline bool assign()
+        {
+            bool rollover = last[Cpu::id] >= max || !generation[Cpu::id];
+
+            if (rollover) {
+                generation[Cpu::id]++;
+                last[Cpu::id] = 0;
+            }
+
+            id  = ++last[Cpu::id];
+            gen = generation[Cpu::id];
+            cpu = static_cast<uint16>(Cpu::id);
+
+            return rollover;
+        }
+};
+
+template <typename T> uint64   Tlb_tag<T>::generation[NUM_CPU];
+template <typename T> unsigned Tlb_tag<T>::last[NUM_CPU];
+template <typename T> unsigned Tlb_tag<T>::max;
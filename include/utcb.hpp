@@ -42,6 +42,12 @@ class Utcb_segment
             limit = static_cast<uint32>(l);
             base  = b;
         }
+
+        ALWAYS_INLINE
+        inline bool operator == (Utcb_segment const &s) const
+        {
+            return sel == s.sel && ar == s.ar && limit == s.limit && base == s.base;
+        }
 };
 
 class Utcb_head
@@ -189,6 +195,47 @@ class Utcb : public Utcb_head, private Utcb_data
 
             items = success;
         }
+
+        ALWAYS_INLINE
+        static inline mword bitmap_bits() { return words * sizeof (mword) * 8; }
+
+        /* Clear the message registers needed for a bitmap of the given size */
+        ALWAYS_INLINE
+        inline mword *bitmap (mword bits)
+        {
+            mword n = (bits + sizeof (mword) * 8 - 1) / (sizeof (mword) * 8);
+
+            for (mword i = 0; i < n; i++)
+                mr[i] = 0;
+
+            items = n;
+
+            return mr;
+        }
+
+        /* Claim the message registers for up to n untyped items of type T */
+        template <typename T>
+        ALWAYS_INLINE
+        inline T *put_items (mword &n)
+        {
+            n = min (n, words * sizeof (mword) / sizeof (T));
+
+            items = n * sizeof (T) / sizeof (mword);
+
+            return reinterpret_cast<T *>(mr);
+        }
+
+        template <typename T, typename F>
+        bool for_each_item (F const &fn) const
+        {
+            T const *t = reinterpret_cast<T const *>(mr);
+
+            for (mword i = 0; i < ui() * sizeof (mword) / sizeof (T); i++)
+                if (!fn (t[i]))
+                    return false;
+
+            return true;
+        }
 };
 
 static_assert (sizeof(Utcb) == 4096, "Unsupported size of Utcb");
@@ -37,7 +37,8 @@
 #define VEC_IPI_RKE     (VEC_IPI + 1)
 #define VEC_IPI_IDL     (VEC_IPI + 2)
 #define VEC_IPI_HLT     (VEC_IPI + 3)
+#define VEC_IPI_PIN     (VEC_IPI + 4)   /* taken outside guest mode only, posts are synced on VM entry */
 
-#if (VEC_IPI_HLT - VEC_IPI + 1 != NUM_IPI)
+#if (VEC_IPI_PIN - VEC_IPI + 1 != NUM_IPI)
 #error "IPI misonfiguration"
 #endif
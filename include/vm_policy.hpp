@@ -0,0 +1,168 @@
+/*
+ * Virtual-Machine Exit Policy
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "buddy.hpp"
+#include "config.hpp"
+#include "cpu.hpp"
+#include "x86.hpp"
+
+class Utcb;
+
+/*
+ * Per-vCPU table of exits the kernel answers on behalf of the VMM. The VMM
+ * enables a reason and supplies the values; a miss is forwarded as usual.
+ */
+class Vm_policy
+{
+    public:
+        enum Reason
+        {
+            CPUID,
+            RDTSC,
+            RDMSR,
+            NUM_REASONS
+        };
+
+        /* Configuration record as passed in the untyped items of the UTCB */
+        struct Item
+        {
+            enum { TYPE_CPUID = 0, TYPE_MSR = 1 };
+            enum { ANY_SUBLEAF = 1U << 0 };
+
+            uint32  type, flags;
+            uint32  key,  subkey;
+            uint64  val[2];
+        };
+
+        static unsigned stat[NUM_CPU][NUM_REASONS];
+
+    private:
+        struct Cpuid
+        {
+            uint32  leaf, subleaf, flags, res;
+            uint32  eax, ebx, ecx, edx;
+        };
+
+        struct Msr
+        {
+            uint32  index, res;
+            uint64  value;
+        };
+
+        enum
+        {
+            CPUID_ENTRIES = 64,
+            MSR_ENTRIES   = 96,
+        };
+
+        mword       mask    { 0 };
+        unsigned    cpuids  { 0 };
+        unsigned    msrs    { 0 };
+        uint64      absorbed[NUM_REASONS] { };
+        Cpuid       cpuid[CPUID_ENTRIES];
+        Msr         msr[MSR_ENTRIES];
+
+        ALWAYS_INLINE
+        inline Cpuid const *find_cpuid (uint32 leaf, uint32 subleaf) const
+        {
+            for (unsigned i = 0; i < cpuids; i++)
+                if (cpuid[i].leaf == leaf && (cpuid[i].subleaf == subleaf || cpuid[i].flags & Item::ANY_SUBLEAF))
+                    return cpuid + i;
+
+            return nullptr;
+        }
+
+        ALWAYS_INLINE
+        inline Msr const *find_msr (uint32 index) const
+        {
+            for (unsigned i = 0; i < msrs; i++)
+                if (msr[i].index == index)
+                    return msr + i;
+
+            return nullptr;
+        }
+
+    public:
+        ALWAYS_INLINE
+        inline bool enabled (Reason r) const { return mask & 1UL << r; }
+
+        ALWAYS_INLINE
+        inline uint64 count (Reason r) const { return absorbed[r]; }
+
+        /*
+         * Emulate the instruction behind exit reason r on the given guest
+         * registers. Returns false, leaving the registers untouched, if the
+         * exit has to be forwarded to the VMM.
+         */
+        ALWAYS_INLINE
+        inline bool emulate (Reason r, mword &ax, mword &cx, mword &dx, mword &bx, uint64 tsc_offset)
+        {
+            if (!enabled (r))
+                return false;
+
+            switch (r) {
+
+                case CPUID:
+                {
+                    Cpuid const *c = find_cpuid (static_cast<uint32>(ax), static_cast<uint32>(cx));
+                    if (!c)
+                        return false;
+
+                    ax = c->eax;
+                    bx = c->ebx;
+                    cx = c->ecx;
+                    dx = c->edx;
+                    break;
+                }
+
+                case RDTSC:
+                {
+                    uint64 tsc = rdtsc() + tsc_offset;
+                    ax = static_cast<uint32>(tsc);
+                    dx = static_cast<uint32>(tsc >> 32);
+                    break;
+                }
+
+                case RDMSR:
+                {
+                    Msr const *m = find_msr (static_cast<uint32>(cx));
+                    if (!m)
+                        return false;
+
+                    ax = static_cast<uint32>(m->value);
+                    dx = static_cast<uint32>(m->value >> 32);
+                    break;
+                }
+
+                default:
+                    return false;
+            }
+
+            absorbed[r]++;
+            stat[Cpu::id][r]++;
+
+            return true;
+        }
+
+        bool configure (mword, Utcb &);
+
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0); }
+
+        ALWAYS_INLINE
+        static inline void destroy (Vm_policy *obj, Quota &quota) { obj->~Vm_policy(); Buddy::allocator.free (reinterpret_cast<mword>(obj), quota); }
+};
@@ -0,0 +1,56 @@
+/*
+ * Virtual-Machine Exit Profile
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "buddy.hpp"
+#include "config.hpp"
+
+/*
+ * Per-vCPU histogram of exit reasons. For each reason it counts the exits
+ * and the TSC cycles from the exit to the next entry into the guest, which
+ * includes the round trip through the VMM.
+ */
+class Vm_profile
+{
+    public:
+        /* Record as passed in the untyped items of the UTCB */
+        struct Entry
+        {
+            uint64  count;
+            uint64  cycles;
+        };
+
+    private:
+        Entry   entry[NUM_VMI];
+
+    public:
+        ALWAYS_INLINE
+        inline void exit (mword r) { entry[r].count++; }
+
+        ALWAYS_INLINE
+        inline void enter (mword r, uint64 c) { entry[r].cycles += c; }
+
+        ALWAYS_INLINE
+        inline Entry const &get (mword r) const { return entry[r]; }
+
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0); }
+
+        ALWAYS_INLINE
+        static inline void destroy (Vm_profile *obj, Quota &quota) { obj->~Vm_profile(); Buddy::allocator.free (reinterpret_cast<mword>(obj), quota); }
+};
+
+static_assert (sizeof (Vm_profile) <= PAGE_SIZE, "Unsupported size of Vm_profile");
@@ -21,10 +21,18 @@
 #pragma once
 
 #include "assert.hpp"
+#include "atomic.hpp"
 #include "msr.hpp"
+#include "mtd.hpp"
 #include "slab.hpp"
 #include "queue.hpp"
+#include "tlb_tag.hpp"
+#include "utcb.hpp"
+#include "util.hpp"
+#include "vpid.hpp"
+#include "x86.hpp"
 
+class Dirty_log;
 class Vmcs_state;
 
 class Vmcs
@@ -38,7 +46,7 @@ class Vmcs
         static Vmcs *current CPULOCAL_HOT;
         static Vmcs *root    CPULOCAL;
 
-        static unsigned vpid_ctr CPULOCAL;
+        static unsigned preempt_rate;
 
         static union vmx_basic {
             uint64      val;
@@ -61,8 +69,14 @@ class Vmcs
                         super       :  2,
                                     :  2,
                         invept      :  1,
-                                    : 11;
-                uint32  invvpid     :  1;
+                        ad          :  1,
+                                    : 10;
+                uint32  invvpid     :  1,
+                                    :  7,
+                        invvpid_addr:  1,
+                        invvpid_ctx :  1,
+                        invvpid_all :  1,
+                                    : 21;
             };
         } ept_vpid CPULOCAL;
 
@@ -105,6 +119,7 @@ class Vmcs
         {
             // 16-Bit Control Fields
             VPID                    = 0x0000ul,
+            PI_NOTIFY_VECTOR        = 0x0002ul,
 
             // 16-Bit Guest State Fields
             GUEST_SEL_ES            = 0x0800ul,
@@ -115,6 +130,8 @@ class Vmcs
             GUEST_SEL_GS            = 0x080aul,
             GUEST_SEL_LDTR          = 0x080cul,
             GUEST_SEL_TR            = 0x080eul,
+            GUEST_INTR_STATUS       = 0x0810ul,
+            GUEST_PML_INDEX         = 0x0812ul,
 
             // 16-Bit Host State Fields
             HOST_SEL_ES             = 0x0c00ul,
@@ -133,12 +150,18 @@ class Vmcs
             EXI_MSR_LD_ADDR         = 0x2008ul,
             ENT_MSR_LD_ADDR         = 0x200aul,
             VMCS_EXEC_PTR           = 0x200cul,
+            PML_ADDR                = 0x200eul,
             TSC_OFFSET              = 0x2010ul,
             TSC_OFFSET_HI           = 0x2011ul,
             APIC_VIRT_ADDR          = 0x2012ul,
             APIC_ACCS_ADDR          = 0x2014ul,
+            PI_DESC_ADDR            = 0x2016ul,
             EPTP                    = 0x201aul,
             EPTP_HI                 = 0x201bul,
+            EOI_EXIT_BITMAP0        = 0x201cul,
+            EOI_EXIT_BITMAP1        = 0x201eul,
+            EOI_EXIT_BITMAP2        = 0x2020ul,
+            EOI_EXIT_BITMAP3        = 0x2022ul,
 
             INFO_PHYS_ADDR          = 0x2400ul,
 
@@ -175,6 +198,8 @@ class Vmcs
             ENT_INST_LEN            = 0x401aul,
             TPR_THRESHOLD           = 0x401cul,
             CPU_EXEC_CTRL1          = 0x401eul,
+            PLE_GAP                 = 0x4020ul,
+            PLE_WINDOW              = 0x4022ul,
 
             // 32-Bit R/O Data Fields
             VMX_INST_ERROR          = 0x4400ul,
@@ -209,6 +234,7 @@ class Vmcs
             GUEST_ACTV_STATE        = 0x4826ul,
             GUEST_SMBASE            = 0x4828ul,
             GUEST_SYSENTER_CS       = 0x482aul,
+            GUEST_PREEMPT_TIMER     = 0x482eul,
 
             // 32-Bit Host State Fields
             HOST_SYSENTER_CS        = 0x4c00ul,
@@ -287,6 +313,8 @@ class Vmcs
             PIN_EXTINT              = 1ul << 0,
             PIN_NMI                 = 1ul << 3,
             PIN_VIRT_NMI            = 1ul << 5,
+            PIN_PREEMPT_TIMER       = 1ul << 6,
+            PIN_POSTED_INT          = 1ul << 7,
         };
 
         enum Ctrl0
@@ -296,10 +324,12 @@ class Vmcs
             CPU_INVLPG              = 1ul << 9,
             CPU_CR3_LOAD            = 1ul << 15,
             CPU_CR3_STORE           = 1ul << 16,
+            CPU_TPR_SHADOW          = 1ul << 21,
             CPU_NMI_WINDOW          = 1ul << 22,
             CPU_IO                  = 1ul << 24,
             CPU_IO_BITMAP           = 1ul << 25,
             CPU_MSR_BITMAP          = 1ul << 28,
+            CPU_PAUSE               = 1ul << 30,
             CPU_SECONDARY           = 1ul << 31,
         };
 
@@ -308,6 +338,10 @@ class Vmcs
             CPU_EPT                 = 1ul << 1,
             CPU_VPID                = 1ul << 5,
             CPU_URG                 = 1ul << 7,
+            CPU_APIC_REG            = 1ul << 8,
+            CPU_VINT                = 1ul << 9,
+            CPU_PLE                 = 1ul << 10,
+            CPU_PML                 = 1ul << 17,
         };
 
         enum Reason
@@ -362,7 +396,8 @@ class Vmcs
             VMX_PREEMPT             = 52,
             VMX_INVVPID             = 53,
             VMX_WBINVD              = 54,
-            VMX_XSETBV              = 55
+            VMX_XSETBV              = 55,
+            VMX_PML_FULL            = 62
         };
 
         ALWAYS_INLINE
@@ -455,19 +490,28 @@ class Vmcs
                 write (GUEST_INTR_STATE, intr & ~3);
         }
 
-        ALWAYS_INLINE
-        static inline unsigned long vpid()
-        {
-            return has_vpid() ? read (VPID) : 0;
-        }
-
         static bool has_msr_bitmap() { return ctrl_cpu[0].clr & CPU_MSR_BITMAP; }
         static bool use_msr_bitmap() { return has_msr_bitmap(); }
         static bool has_secondary()  { return ctrl_cpu[0].clr & CPU_SECONDARY; }
         static bool has_ept()        { return ctrl_cpu[1].clr & CPU_EPT; }
         static bool has_vpid()       { return ctrl_cpu[1].clr & CPU_VPID; }
+        static bool has_vpid_addr()  { return has_vpid() && ept_vpid.invvpid_addr; }
         static bool has_urg()        { return ctrl_cpu[1].clr & CPU_URG; }
         static bool has_vnmi()       { return ctrl_pin.clr & PIN_VIRT_NMI; }
+        static bool has_posted()     { return ctrl_pin.clr & PIN_POSTED_INT && ctrl_cpu[1].clr & CPU_VINT && ctrl_exi.clr & EXI_INTA; }
+        static bool has_ple()        { return ctrl_cpu[1].clr & CPU_PLE; }
+        static bool has_ept_ad()     { return has_ept() && ept_vpid.ad; }
+        static bool has_pml()        { return ctrl_cpu[1].clr & CPU_PML && has_ept_ad(); }
+        static bool has_preempt()    { return ctrl_pin.clr & PIN_PREEMPT_TIMER; }
+
+        /* Let the VMX-preemption timer expire no earlier than TSC value t */
+        ALWAYS_INLINE
+        static inline void set_preempt (uint64 t)
+        {
+            uint64 now = rdtsc(), d = t > now ? (t - now + (1ULL << preempt_rate) - 1) >> preempt_rate : 0;
+
+            write (GUEST_PREEMPT_TIMER, static_cast<mword>(min (d, static_cast<uint64>(~0U))));
+        }
 
         static void init();
 };
@@ -548,7 +592,7 @@ struct Virtual_apic_page
 {
     uint32 data [4096 / 4];
 
-    enum { VTPR = 0x80 / 4 };
+    enum { VTPR = 0x80 / 4, VIRR = 0x200 / 4 };
 
     ALWAYS_INLINE
     static inline void *operator new (size_t, Quota &quota)
@@ -565,6 +609,120 @@ struct Virtual_apic_page
 
     uint32 vtpr() { return data[VTPR]; }
     void vtpr(uint32 value) { data[VTPR] = value; }
+
+    uint32 &virr (unsigned i) { return data[VIRR + i * 4]; }
+};
+
+/*
+ * Posted-interrupt descriptor: vectors are set in pir by any CPU and moved
+ * into the virtual IRR by the processor on notification or by the kernel
+ * on the next VM entry.
+ */
+struct Pi_desc
+{
+    uint32 pir[8];
+    uint32 ctrl;
+    uint32 reserved[7];
+
+    enum { ON = 0 };
+
+    ALWAYS_INLINE
+    static inline void *operator new (size_t, Quota &quota)
+    {
+        /* allocate one page */
+        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+    }
+
+    ALWAYS_INLINE
+    static inline void destroy(Pi_desc *obj, Quota &quota)
+    {
+        Buddy::allocator.free (reinterpret_cast<mword>(obj), quota);
+    }
+
+    /* Returns true if the caller has to send the notification */
+    ALWAYS_INLINE
+    inline bool post (unsigned vector)
+    {
+        __sync_fetch_and_or (&pir[vector / 32], 1U << (vector % 32));
+        return !Atomic::test_set_bit (ctrl, ON);
+    }
+
+    ALWAYS_INLINE
+    inline bool pending() const { return ctrl & 1U << ON; }
+
+    ALWAYS_INLINE
+    inline void acknowledge() { Atomic::test_clr_bit (ctrl, ON); }
+
+    ALWAYS_INLINE
+    inline uint32 take (unsigned i) { return __sync_fetch_and_and (&pir[i], 0); }
+};
+
+/*
+ * Page-modification log: the processor stores the guest-physical address of
+ * every page whose EPT dirty bit it sets, from the last entry downwards.
+ */
+struct Pml_log
+{
+    enum { ENTRIES = PAGE_SIZE / sizeof (uint64) };
+
+    uint64 gpa[ENTRIES];
+
+    ALWAYS_INLINE
+    static inline void *operator new (size_t, Quota &quota)
+    {
+        /* allocate one page */
+        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+    }
+
+    ALWAYS_INLINE
+    static inline void destroy(Pml_log *obj, Quota &quota)
+    {
+        Buddy::allocator.free (reinterpret_cast<mword>(obj), quota);
+    }
+};
+
+/*
+ * Memory copy of guest-state fields as last read from or written to the
+ * VMCS. A group stays valid until the next VM entry, so UTCB transfers in
+ * between avoid VMREAD for cached groups and VMWRITE for unchanged fields.
+ */
+class Vmcs_cache
+{
+    private:
+        mword valid { 0 };
+
+    public:
+        static mword const groups = Mtd::RSP | Mtd::RIP_LEN | Mtd::RFLAGS |
+                                    Mtd::DS_ES | Mtd::FS_GS | Mtd::CS_SS |
+                                    Mtd::TR | Mtd::LDTR | Mtd::GDTR | Mtd::IDTR |
+                                    Mtd::DR | Mtd::SYSENTER | Mtd::STA | Mtd::PDPTE;
+
+        mword           rsp { }, rip { }, rflags { }, dr7 { };
+        mword           sysenter_cs { }, sysenter_rsp { }, sysenter_rip { };
+        mword           pdpte[4] { };
+        uint32          intr_state { }, actv_state { };
+        Utcb_segment    es { }, cs { }, ss { }, ds { }, fs { }, gs { }, ld { }, tr { }, gd { }, id { };
+
+        ALWAYS_INLINE
+        inline bool cached (mword g) const { return valid & g; }
+
+        ALWAYS_INLINE
+        inline void validate (mword m) { valid |= m & groups; }
+
+        ALWAYS_INLINE
+        inline void invalidate() { valid = 0; }
+
+        /* Returns true if v has to be written to the VMCS */
+        template <typename T>
+        ALWAYS_INLINE
+        inline bool update (mword g, T &c, T const &v)
+        {
+            if (cached (g) && c == v)
+                return false;
+
+            c = v;
+            return true;
+        }
 };
 
 class Vmcs_state
@@ -575,6 +733,7 @@ class Vmcs_state
 
         static Slab_cache        cache;
         static Queue<Vmcs_state> queue CPULOCAL;
+        static unsigned          loaded[NUM_CPU];
 
         Vmcs        & vmcs;
         Vmcs_state  * prev   { };
@@ -587,8 +746,54 @@ class Vmcs_state
 
         bool queued() const { return prev || next; }
 
+        /* Make room in the working set by clearing its least recently used VMCS */
+        ALWAYS_INLINE
+        static inline void evict()
+        {
+            if (loaded[Cpu::id] >= WORKING_SET)
+                queue.head()->clear();
+        }
+
     public:
 
+        /* Active VMCSs kept per CPU before the least recently used is cleared */
+        enum { WORKING_SET = 8 };
+
+        enum Stat { VMPTRLD, VMCLEAR, HIT, MISS, NUM_STATS };
+
+        static unsigned stat[NUM_CPU][NUM_STATS];
+
+        Vmcs_cache    guest  { };
+        Tlb_tag<Vmcs> vpid   { };
+        Pi_desc     * pi     { };
+        Pml_log     * pml    { };
+        uint32        eoi[8] { };
+        bool          apicv  { };
+        bool          pml_on { };
+        bool          eoi_on { };
+
+        void sync_posted();
+
+        bool deliverable() const;
+
+        /* Returns true if the EOI-exit bitmap changed and has to be reloaded */
+        ALWAYS_INLINE
+        inline bool eoi_exit (unsigned vector, bool level)
+        {
+            uint32 const m = 1U << (vector % 32);
+            uint32 const o = level ? __sync_fetch_and_or (&eoi[vector / 32], m) : __sync_fetch_and_and (&eoi[vector / 32], ~m);
+
+            if (!(o & m) == !level)
+                return false;
+
+            eoi_on = true;
+            return true;
+        }
+
+        void sync_eoi();
+
+        void drain_pml (Dirty_log &);
+
         ALWAYS_INLINE
         static inline void *operator new (size_t, Quota &quota) { return cache.alloc(quota); }
 
@@ -602,7 +807,8 @@ class Vmcs_state
 
         static void flush_all_vmcs()
         {
-            queue.for_each([](auto &vmcs) { vmcs.clear(); });
+            while (queue.head())
+                queue.head()->clear();
         }
 
         static void destroy(Vmcs_state *, Quota &);
@@ -610,25 +816,57 @@ class Vmcs_state
         ALWAYS_INLINE
         inline void make_current()
         {
-            if (Cpu::id == cpu && !queued())
-                queue.enqueue(this);
+            if (EXPECT_TRUE (Vmcs::current == &vmcs && active))
+                return;
+
+            /* the queue of active VMCSs is kept in LRU order, head first */
+            if (Cpu::id == cpu) {
+                if (queued()) {
+                    queue.dequeue (this);
+                    stat[Cpu::id][HIT]++;
+                } else {
+                    evict();
+                    loaded[Cpu::id]++;
+                    stat[Cpu::id][MISS]++;
+                }
+
+                queue.enqueue (this);
+            }
+
+            if (Vmcs::current != &vmcs)
+                stat[Cpu::id][VMPTRLD]++;
 
             vmcs.make_current();
 
             active = true;
         }
 
+        /* Give the current VMCS a VPID of this CPU unless it still has one */
+        ALWAYS_INLINE
+        inline void load_vpid()
+        {
+            if (EXPECT_TRUE (!Vmcs::has_vpid() || vpid.valid()))
+                return;
+
+            if (vpid.assign())
+                Vpid::flush (Vpid::CONTEXT_ALL, 0);
+
+            Vmcs::write (Vmcs::VPID, vpid.id);
+        }
+
         ALWAYS_INLINE
         inline void clear()
         {
-            if (Cpu::id == cpu && queued())
-                queue.dequeue(this);
+            if (Cpu::id == cpu && queue.dequeue (this))
+                loaded[Cpu::id]--;
 
             if (!active)
                 return;
 
             vmcs.clear();
 
+            stat[Cpu::id][VMCLEAR]++;
+
             active = false;
         }
 
@@ -38,6 +38,7 @@ class Vpid
         {
             ADDRESS             = 0,
             CONTEXT_GLOBAL      = 1,
+            CONTEXT_ALL         = 2,
             CONTEXT_NOGLOBAL    = 3
         };
 
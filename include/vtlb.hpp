@@ -20,10 +20,12 @@
 
 #pragma once
 
+#include "atomic.hpp"
 #include "pte.hpp"
+#include "spinlock.hpp"
 #include "user.hpp"
 
-class Exc_regs;
+class Cpu_regs;
 
 #ifdef __i386__
 class Vtlb : public Pte<Vtlb, uint32, 2, 10, false, false>
@@ -31,6 +33,8 @@ class Vtlb : public Pte<Vtlb, uint32, 2, 10, false, false>
 class Vtlb : public Pte<Vtlb, uint64, 3,  9, false, false>
 #endif
 {
+    friend class Vtlb_cache;
+
     private:
         ALWAYS_INLINE
         inline bool mark() const { return val & TLB_M; }
@@ -46,8 +50,14 @@ class Vtlb : public Pte<Vtlb, uint64, 3,  9, false, false>
 
         void flush_ptab (bool);
 
+        void free_ptab (Quota &, unsigned);
+
+#ifdef __x86_64__
+        static size_t gwalk_pae (Cpu_regs *, mword, mword &, mword &, mword &);
+#endif
+
     public:
-        static size_t gwalk (Exc_regs *, mword, mword &, mword &, mword &);
+        static size_t gwalk (Cpu_regs *, mword, mword &, mword &, mword &);
         static size_t hwalk (mword, mword &, mword &, mword &);
 
         enum
@@ -66,6 +76,13 @@ class Vtlb : public Pte<Vtlb, uint64, 3,  9, false, false>
             PTE_P   = TLB_P,
         };
 
+#ifdef __x86_64__
+        enum : uint64
+        {
+            TLB_NX  = 1ULL << 63,
+        };
+#endif
+
         enum Reason
         {
             SUCCESS,
@@ -86,9 +103,15 @@ class Vtlb : public Pte<Vtlb, uint64, 3,  9, false, false>
                 this[i].val = TLB_S;
         }
 
-        void flush (mword);
+        /* Shadow paging depth: 4 levels for a long-mode guest, PAE otherwise */
+        ALWAYS_INLINE
+        static inline unsigned levels (bool lm) { return lm ? 4 : max(); }
+
+        void flush (mword, bool);
         void flush (bool);
 
+        static void depth (Cpu_regs *, bool);
+
         static Reason miss (Cpu_regs *, mword, mword &);
 
         ALWAYS_INLINE
@@ -97,3 +120,135 @@ class Vtlb : public Pte<Vtlb, uint64, 3,  9, false, false>
         ALWAYS_INLINE
         static inline void destroy(Vtlb *obj, Quota &quota) { obj->~Vtlb(); Buddy::allocator.free (reinterpret_cast<mword>(obj), quota); }
 };
+
+/*
+ * Guest page-table frames tracked for all vCPUs of a PD.
+ *
+ * Frames any guest walk reads entries from are tracked as page tables and
+ * leaves mapping them are filled read-only. A newly tracked frame or a
+ * write to a tracked frame starts a new generation: a vCPU may then map
+ * page tables writable and its writes go unseen until it has flushed its
+ * active root completely. Once all vCPUs have done so, a clean generation
+ * follows in which no write goes unseen. Odd generations are clean.
+ */
+class Vtlb_track
+{
+    private:
+        enum
+        {
+            LIMIT_BITS  = 32,
+            REGION_BITS = 21,
+            BITS        = sizeof (mword) * 8,
+            MAP_ORDER   = LIMIT_BITS - 2 * PAGE_BITS - 3,
+        };
+
+        Spinlock    lock                                                    { };
+        mword *     frame;
+        mword       gen                                                     { 2 };
+        unsigned    synced                                                  { 0 };
+        mword       region[(1ULL << (LIMIT_BITS - REGION_BITS)) / BITS]     { };
+
+        ALWAYS_INLINE
+        static inline uint64 limit() { return 1ULL << LIMIT_BITS; }
+
+        ALWAYS_INLINE
+        static inline bool test (mword const *map, mword i) { return map[i / BITS] & 1UL << i % BITS; }
+
+        ALWAYS_INLINE
+        static inline void set (mword *map, mword i) { Atomic::set_mask (map[i / BITS], 1UL << i % BITS); }
+
+        bool tracked (mword, size_t) const;
+
+        void invalidate();
+
+        Vtlb_track (Vtlb_track const &);
+        Vtlb_track &operator = (Vtlb_track const &);
+
+    public:
+        enum State
+        {
+            STALE,          // vCPU must flush its active root completely
+            WAIT,           // vCPU flushed, others have not yet
+            FRESH,          // vCPU flushed in a clean generation
+        };
+
+        static unsigned const map_pages = 1U << MAP_ORDER;
+
+        explicit Vtlb_track (Quota &);
+
+        ALWAYS_INLINE
+        inline mword generation() const { return ACCESS_ONCE (gen); }
+
+        State state (Cpu_regs const *) const;
+
+        void track (uint64);
+
+        void protect (Cpu_regs const *, mword, size_t &, mword &, mword);
+
+        void sync (Cpu_regs *);
+
+        void detach (Cpu_regs const *);
+
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0); }
+
+        static void destroy (Vtlb_track *, Quota &);
+};
+
+/*
+ * Shadow roots of recently used guest address spaces of one vCPU, keyed by
+ * guest CR3. Roots are cached and reused only while the vCPU is fresh in
+ * the tracking generation of its PD; a new generation drops them.
+ */
+class Vtlb_cache
+{
+    private:
+        enum
+        {
+            ROOTS       = 4,
+            BACKOFF     = 64,
+        };
+
+        struct Slot
+        {
+            Vtlb *  root;
+            mword   cr3;
+            mword   used;
+            bool    valid;
+        };
+
+        Slot        slot[ROOTS]                                             { };
+        mword       stamp                                                   { 0 };
+        mword       gen                                                     { 0 };
+        unsigned    hits                                                    { 0 };
+        unsigned    probe                                                   { 0 };
+        unsigned    backoff                                                 { 1 };
+        bool        safe                                                    { true };
+
+        void unsafe();
+
+        Vtlb_cache (Vtlb_cache const &);
+        Vtlb_cache &operator = (Vtlb_cache const &);
+
+    public:
+        enum Result
+        {
+            FLUSH,          // not cached, flush the active root
+            FLUSH_ALL,      // flush the active root completely to resume caching
+            HIT,            // active root is still valid
+            SWITCH,         // active root was replaced
+        };
+
+        Vtlb_cache() = default;
+
+        void free_roots (Quota &, unsigned);
+
+        static Result load (Cpu_regs *, mword);
+
+        static void flushed (Cpu_regs *);
+
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0); }
+
+        static void destroy (Vtlb_cache *, Quota &, unsigned);
+};
@@ -28,11 +28,14 @@
 #include "acpi_mcfg.hpp"
 #include "acpi_rsdp.hpp"
 #include "acpi_rsdt.hpp"
+#include "acpi_slit.hpp"
+#include "acpi_srat.hpp"
 #include "assert.hpp"
 #include "bits.hpp"
 #include "gsi.hpp"
 #include "hpt.hpp"
 #include "io.hpp"
+#include "numa.hpp"
 #include "pic.hpp"
 #include "stdio.hpp"
 #include "x86.hpp"
@@ -40,7 +43,7 @@
 #include "console.hpp"
 #include "ec.hpp"
 
-Paddr       Acpi::dmar, Acpi::fadt, Acpi::facs, Acpi::hpet, Acpi::madt, Acpi::mcfg, Acpi::rsdt, Acpi::xsdt, Acpi::ivrs;
+Paddr       Acpi::dmar, Acpi::fadt, Acpi::facs, Acpi::hpet, Acpi::madt, Acpi::mcfg, Acpi::rsdt, Acpi::xsdt, Acpi::ivrs, Acpi::srat, Acpi::slit;
 Acpi_gas    Acpi::pm1a_sts, Acpi::pm1b_sts, Acpi::pm1a_ena, Acpi::pm1b_ena, Acpi::pm1a_cnt, Acpi::pm1b_cnt, Acpi::pm2_cnt, Acpi::pm_tmr, Acpi::reset_reg;
 Acpi_gas    Acpi::gpe0_sts, Acpi::gpe1_sts, Acpi::gpe0_ena, Acpi::gpe1_ena;
 uint32      Acpi::feature;
@@ -63,7 +66,7 @@ void Acpi::reset()
     write (RESET, reset_val);
 }
 
-void Acpi::setup()
+void Acpi::tables()
 {
     if (!xsdt && !rsdt)
         Acpi_rsdp::parse();
@@ -72,6 +75,27 @@ void Acpi::setup()
         static_cast<Acpi_table_rsdt *>(Hpt::remap (Pd::kern.quota, xsdt))->parse (xsdt, sizeof (uint64));
     else if (rsdt)
         static_cast<Acpi_table_rsdt *>(Hpt::remap (Pd::kern.quota, rsdt))->parse (rsdt, sizeof (uint32));
+}
+
+/*
+ * The memory topology is needed before the kernel memory pools are set up,
+ * so SRAT and SLIT are parsed ahead of the remaining tables
+ */
+void Acpi::numa()
+{
+    tables();
+
+    if (srat)
+        static_cast<Acpi_table_srat *>(Hpt::remap (Pd::kern.quota, srat))->parse();
+    if (slit)
+        static_cast<Acpi_table_slit *>(Hpt::remap (Pd::kern.quota, slit))->parse();
+
+    Numa::setup();
+}
+
+void Acpi::setup()
+{
+    tables();
 
     if (fadt)
         static_cast<Acpi_table_fadt *>(Hpt::remap (Pd::kern.quota, fadt))->parse();
@@ -31,6 +31,8 @@ struct Acpi_table_rsdt::table_map Acpi_table_rsdt::map[] INITDATA =
     { SIG ('H','P','E','T'),    &Acpi::hpet },
     { SIG ('M','C','F','G'),    &Acpi::mcfg },
     { SIG ('I','V','R','S'),    &Acpi::ivrs },
+    { SIG ('S','R','A','T'),    &Acpi::srat },
+    { SIG ('S','L','I','T'),    &Acpi::slit },
 };
 
 void Acpi_table_rsdt::parse (Paddr addr, size_t size) const
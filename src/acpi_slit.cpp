@@ -0,0 +1,30 @@
+/*
+ * ACPI - System Locality Information Table (SLIT)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "acpi_slit.hpp"
+#include "numa.hpp"
+
+void Acpi_table_slit::parse() const
+{
+    uint32 const size = static_cast<uint32>(length - sizeof (Acpi_table) - sizeof (count));
+
+    if (!count || count > 0xffff || count * count > size)
+        return;
+
+    // Proximity domains are the row and column indices of the matrix
+    for (uint32 i = 0; i < count; i++)
+        for (uint32 j = 0; j < count; j++)
+            Numa::set_distance (i, j, entry[i * count + j]);
+}
@@ -0,0 +1,59 @@
+/*
+ * ACPI - System Resource Affinity Table (SRAT)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "acpi_srat.hpp"
+#include "numa.hpp"
+
+void Acpi_table_srat::parse() const
+{
+    parse_entry (Acpi_affinity::LAPIC,  &parse_lapic);
+    parse_entry (Acpi_affinity::X2APIC, &parse_x2apic);
+    parse_entry (Acpi_affinity::MEMORY, &parse_mem);
+}
+
+void Acpi_table_srat::parse_entry (Acpi_affinity::Type type, void (*handler)(Acpi_affinity const *)) const
+{
+    for (Acpi_affinity const *ptr = affinity; ptr < reinterpret_cast<Acpi_affinity *>(reinterpret_cast<mword>(this) + length); ptr = reinterpret_cast<Acpi_affinity *>(reinterpret_cast<mword>(ptr) + ptr->length)) {
+        if (!ptr->length)
+            break;
+
+        if (ptr->type == type)
+            (*handler)(ptr);
+    }
+}
+
+void Acpi_table_srat::parse_lapic (Acpi_affinity const *ptr)
+{
+    Acpi_affinity_lapic const *p = static_cast<Acpi_affinity_lapic const *>(ptr);
+
+    if (p->flags & 1)
+        Numa::add_cpu (p->pxm(), p->apic_id);
+}
+
+void Acpi_table_srat::parse_x2apic (Acpi_affinity const *ptr)
+{
+    Acpi_affinity_x2apic const *p = static_cast<Acpi_affinity_x2apic const *>(ptr);
+
+    if (p->flags & 1)
+        Numa::add_cpu (p->pxm, p->x2apic_id);
+}
+
+void Acpi_table_srat::parse_mem (Acpi_affinity const *ptr)
+{
+    Acpi_affinity_mem const *p = static_cast<Acpi_affinity_mem const *>(ptr);
+
+    if (p->flags & 1)
+        Numa::add_mem (p->pxm, p->base, p->size);
+}
@@ -19,13 +19,16 @@
  */
 
 #include "assert.hpp"
+#include "barrier.hpp"
 #include "bits.hpp"
 #include "buddy.hpp"
 #include "initprio.hpp"
 #include "lock_guard.hpp"
+#include "numa.hpp"
 #include "stdio.hpp"
 #include "string.hpp"
 #include "pd.hpp"
+#include "x86.hpp"
 
 extern char _mempool_p, _mempool_l, _mempool_f, _mempool_e;
 
@@ -44,8 +47,8 @@ Buddy Buddy::allocator (reinterpret_cast<mword>(&_mempool_p),
 
 Buddy * Buddy::list;
 
-Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size)
-: List<Buddy>(list)
+Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size, unsigned n)
+: List<Buddy>(list), node (n)
 {
     // Compute maximum aligned block size
     unsigned long bit = bit_scan_reverse (size);
@@ -56,10 +59,10 @@ Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size)
     // Convert block size to page order
     order = bit + 1 - PAGE_BITS;
 
-    trace (TRACE_MEMORY, "POOL: %#010lx-%#010lx O:%lu",
+    trace (TRACE_MEMORY, "POOL: %#010lx-%#010lx O:%lu N:%u",
            phys,
            phys + size,
-           order);
+           order, node);
 
     // Allocate block-list heads
     size -= order * sizeof *head;
@@ -70,13 +73,26 @@ Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size)
     size &= ~PAGE_MASK;
     min_idx = page_to_index (virt);
     max_idx = page_to_index (virt + size);
-    index = reinterpret_cast<Block *>(virt + size) - min_idx;
+    index = reinterpret_cast<uint8 *>(virt + size) - min_idx;
 
     for (unsigned i = 0; i < order; i++)
         head[i].next = head[i].prev = head + i;
 
-    for (mword i = f_addr; i < virt + size; i += PAGE_SIZE)
+    // Release the pool in the largest aligned blocks instead of page by page
+    for (mword i = f_addr; i < virt + size;) {
+
+        signed long idx = page_to_index (i);
+
+        unsigned short o = 0;
+        while (o + 1u < order && !(idx & ((1l << (o + 1)) - 1)) && i + (PAGE_SIZE << (o + 1)) <= virt + size)
+            o++;
+
+        index[idx] = static_cast<uint8>(o);
+
         _free (i, Quota::init);
+
+        i += PAGE_SIZE << o;
+    }
 }
 
 /*
@@ -95,26 +111,26 @@ void *Buddy::_alloc (unsigned short ord, Quota &quota, Fill fill)
             continue;
 
         Block *block = head[j].next;
-        block->prev->next = block->next;
-        block->next->prev = block->prev;
-        block->ord = ord;
-        block->tag = Block::Used;
+        dequeue (block);
+
+        signed long idx = block_to_index (block);
+        index[idx] = static_cast<uint8>(ord);
 
         while (j-- != ord) {
-            Block *buddy = block + (1ul << j);
+            signed long buddy_idx = idx + (1l << j);
+            Block *buddy = index_to_block (buddy_idx);
             buddy->prev = buddy->next = head + j;
-            buddy->ord = j;
-            buddy->tag = Block::Free;
+            index[buddy_idx] = static_cast<uint8>(Free | j);
             head[j].next = head[j].prev = buddy;
         }
 
-        mword virt = index_to_page (block_to_index (block));
+        mword virt = index_to_page (idx);
 
         // Ensure corresponding physical block is order-aligned
-        assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
+        assert ((virt_to_phys (virt) & ((1ul << (ord + PAGE_BITS)) - 1)) == 0);
 
         if (fill)
-            memset (reinterpret_cast<void *>(virt), fill == FILL_0 ? 0 : -1, 1ul << (block->ord + PAGE_BITS));
+            memset (reinterpret_cast<void *>(virt), fill == FILL_0 ? 0 : -1, 1ul << (ord + PAGE_BITS));
 
         quota.alloc(1ul << ord);
 
@@ -126,6 +142,24 @@ void *Buddy::_alloc (unsigned short ord, Quota &quota, Fill fill)
 
 void *Buddy::alloc (unsigned short ord, Quota &quota, Fill fill)
 {
+    /*
+     * Prefer the node of the current CPU and fall back by distance. While a
+     * CPU boots (boot_lock taken) it may run without its CPU-local page, so
+     * the plain list order is used then.
+     */
+    if (Numa::nodes > 1 && ACCESS_ONCE (Cpu::boot_lock)) {
+        unsigned const home = Cpu::node[Cpu::id];
+
+        for (unsigned i = 0; i < Numa::nodes; i++)
+            for (Buddy *b = list; b; b = b->next) {
+                if (b->node != Numa::order[home][i])
+                    continue;
+
+                void * v = b->_alloc(ord, quota, fill);
+                if (v) return v;
+            }
+    }
+
     for (Buddy *b = list; b; b = b->next) {
         void * v = b->_alloc(ord, quota, fill);
         if (v) return v;
@@ -147,52 +181,43 @@ void Buddy::_free (mword virt, Quota &quota)
     // Ensure virt is within allocator range
     assert (idx >= min_idx && idx < max_idx);
 
-    Block *block = index_to_block (idx);
-
     // Ensure block is marked as used
-    assert (block->tag == Block::Used);
+    assert (!(index[idx] & Free));
+
+    unsigned short ord = index[idx] & Order;
 
     // Ensure corresponding physical block is order-aligned
-    assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
+    assert ((virt_to_phys (virt) & ((1ul << (ord + PAGE_BITS)) - 1)) == 0);
 
-    quota.free(1ul << block->ord);
+    quota.free(1ul << ord);
 
     Lock_guard <Spinlock> guard (lock);
 
-    unsigned short ord;
-    for (ord = block->ord; ord < order - 1; ord++) {
+    for (; ord < order - 1; ord++) {
 
-        // Compute block index and corresponding buddy index
-        signed long block_idx = block_to_index (block);
-        signed long buddy_idx = block_idx ^ (1ul << ord);
+        // Compute corresponding buddy index
+        signed long buddy_idx = idx ^ (1l << ord);
 
         // Buddy outside mempool
         if (buddy_idx < min_idx || buddy_idx >= max_idx)
             break;
 
-        Block *buddy = index_to_block (buddy_idx);
-
         // Buddy in use or fragmented
-        if (buddy->tag == Block::Used || buddy->ord != ord)
+        if (index[buddy_idx] != (Free | ord))
             break;
 
         // Dequeue buddy from block list
-        buddy->prev->next = buddy->next;
-        buddy->next->prev = buddy->prev;
+        dequeue (index_to_block (buddy_idx));
 
         // Merge block with buddy
-        if (buddy < block)
-            block = buddy;
+        if (buddy_idx < idx)
+            idx = buddy_idx;
     }
 
-    block->ord = ord;
-    block->tag = Block::Free;
+    index[idx] = static_cast<uint8>(Free | ord);
 
     // Enqueue final-size block
-    Block *h = head + ord;
-    block->prev = h;
-    block->next = h->next;
-    block->next->prev = h->next = block;
+    enqueue (index_to_block (idx), ord);
 }
 
 void Buddy::free (mword virt, Quota &quota)
@@ -208,6 +233,49 @@ void Buddy::free (mword virt, Quota &quota)
     Console::panic ("Invalid memory free");
 }
 
+void Quota::refill (Credit &c, mword p)
+{
+    mword need = p - c.pages;
+
+    Lock_guard <Spinlock> guard (lock);
+
+    // Pre-charge one chunk as long as the limit is not touched by it
+    mword extra = (used + need + Credit::CHUNK <= upli) ? mword (Credit::CHUNK) : 0;
+
+    used   += need + extra;
+    c.pages = extra;
+}
+
+Quota::Quota (Quota *from) : used(0), over(0), upli(0), notr(0), objs(0), credit(from ? static_cast<Credit *>(Buddy::allocator.alloc (0, *from, Buddy::FILL_0)) : nullptr) { }
+
+/*
+ * Return the credit of all CPUs and release the credit page to the given
+ * quota, the quota must not be in use anymore
+ */
+void Quota::drain (Quota &to)
+{
+    mword p = 0;
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+        p += credit[cpu].pages;
+
+    Buddy::allocator.free (reinterpret_cast<mword>(credit), to);
+    credit = nullptr;
+
+    if (p)
+        uncharge (p);
+}
+
+mword Quota::outstanding()
+{
+    mword sum = 0;
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+        sum += ACCESS_ONCE (credit[cpu].pages);
+
+    return sum;
+}
+
 void Quota::dump(void * pd, bool all)
 {
     if (all) {
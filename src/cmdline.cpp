@@ -37,6 +37,8 @@ bool Cmdline::novpid;
 bool Cmdline::logmem;
 bool Cmdline::fpu_lazy;
 bool Cmdline::hlt;
+bool Cmdline::arena;
+bool Cmdline::rcu_chunk;
 
 struct Cmdline::param_map Cmdline::map[] INITDATA =
 {
@@ -53,6 +55,8 @@ struct Cmdline::param_map Cmdline::map[] INITDATA =
     { "logmem",      &Cmdline::logmem      },
     { "fpu_lazy",    &Cmdline::fpu_lazy    },
     { "hlt",         &Cmdline::hlt         },
+    { "arena",       &Cmdline::arena       },
+    { "rcu_chunk",   &Cmdline::rcu_chunk   },
 };
 
 char const *Cmdline::get_arg (char const **line, unsigned &len)
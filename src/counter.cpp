@@ -19,7 +19,11 @@
  */
 
 #include "counter.hpp"
+#include "ec.hpp"
+#include "fpu.hpp"
 #include "stdio.hpp"
+#include "vm_policy.hpp"
+#include "vmx.hpp"
 #include "x86.hpp"
 
 unsigned    Counter::ipi[NUM_IPI];
@@ -33,6 +37,13 @@ unsigned    Counter::vtlb_fill;
 unsigned    Counter::vtlb_flush;
 unsigned    Counter::schedule;
 unsigned    Counter::helping;
+unsigned    Counter::rcu_exp;
+unsigned    Counter::rcu_exp_oom;
+unsigned    Counter::rcu_batches;
+unsigned    Counter::rcu_elems;
+unsigned    Counter::rcu_max_len;
+uint64      Counter::rcu_cycles;
+uint64      Counter::rcu_max_cycles;
 uint64      Counter::cycles_idle;
 
 void Counter::dump()
@@ -45,8 +56,29 @@ void Counter::dump()
     trace (0, "VFLU: %16u", Counter::vtlb_flush);
     trace (0, "SCHD: %16u", Counter::schedule);
     trace (0, "HELP: %16u", Counter::helping);
+    trace (0, "REXP: %16u", Counter::rcu_exp);
+    trace (0, "ROOM: %16u", Counter::rcu_exp_oom);
+    trace (0, "RCUB: %16u elems %u max %u cycles %llu max %llu", Counter::rcu_batches, Counter::rcu_elems, Counter::rcu_max_len, Counter::rcu_cycles, Counter::rcu_max_cycles);
 
     Counter::vtlb_gpf = Counter::vtlb_hpf = Counter::vtlb_fill = Counter::vtlb_flush = Counter::schedule = Counter::helping = 0;
+    Counter::rcu_exp = Counter::rcu_exp_oom = Counter::rcu_batches = Counter::rcu_elems = Counter::rcu_max_len = 0;
+    Counter::rcu_cycles = Counter::rcu_max_cycles = 0;
+
+    unsigned *vmp = Vm_policy::stat[Cpu::id];
+    trace (0, "VMPA: %16u cpuid %u rdtsc %u rdmsr %u", vmp[Vm_policy::CPUID] + vmp[Vm_policy::RDTSC] + vmp[Vm_policy::RDMSR], vmp[Vm_policy::CPUID], vmp[Vm_policy::RDTSC], vmp[Vm_policy::RDMSR]);
+    vmp[Vm_policy::CPUID] = vmp[Vm_policy::RDTSC] = vmp[Vm_policy::RDMSR] = 0;
+
+    unsigned *hlt = Ec::halt_stat[Cpu::id];
+    trace (0, "HLTP: %16u misses %u", hlt[Ec::HALT_POLL_HIT], hlt[Ec::HALT_POLL_MISS]);
+    hlt[Ec::HALT_POLL_HIT] = hlt[Ec::HALT_POLL_MISS] = 0;
+
+    unsigned *vms = Vmcs_state::stat[Cpu::id];
+    trace (0, "VMCS: %16u vmclear %u hits %u misses %u", vms[Vmcs_state::VMPTRLD], vms[Vmcs_state::VMCLEAR], vms[Vmcs_state::HIT], vms[Vmcs_state::MISS]);
+    vms[Vmcs_state::VMPTRLD] = vms[Vmcs_state::VMCLEAR] = vms[Vmcs_state::HIT] = vms[Vmcs_state::MISS] = 0;
+
+    unsigned *xsv = Fpu::xsv_stat[Cpu::id];
+    trace (0, "XSVS: %16u elided %u", xsv[Fpu::XSV_SWITCHED], xsv[Fpu::XSV_ELIDED]);
+    xsv[Fpu::XSV_SWITCHED] = xsv[Fpu::XSV_ELIDED] = 0;
 
     for (unsigned i = 0; i < sizeof (Counter::ipi) / sizeof (*Counter::ipi); i++)
         if (Counter::ipi[i]) {
@@ -29,6 +29,7 @@
 #include "lapic.hpp"
 #include "mca.hpp"
 #include "msr.hpp"
+#include "numa.hpp"
 #include "pd.hpp"
 #include "stdio.hpp"
 #include "svm.hpp"
@@ -52,6 +53,7 @@ uint8       Cpu::apic_id[NUM_CPU];
 unsigned    Cpu::id;
 unsigned    Cpu::hazard;
 uint8       Cpu::package[NUM_CPU];
+uint8       Cpu::node[NUM_CPU];
 uint8       Cpu::core[NUM_CPU];
 uint8       Cpu::thread[NUM_CPU];
 
@@ -160,8 +162,7 @@ void Cpu::check_features()
                 eax = ebx = ecx = edx = 0;
                 cpuid (0x8000000a, Vmcb::svm_version, ebx, ecx, Vmcb::svm_feature);
 
-                if (ebx < Space_mem::asid_alloc.max())
-                    Space_mem::asid_alloc.reserve(ebx, Space_mem::asid_alloc.max() - ebx);
+                Tlb_tag<Vmcb>::max = ebx - 1;
 
                 [[fallthrough]];
             case 0x8 ... 0x9:
@@ -366,8 +367,10 @@ void Cpu::init(bool resume)
            Cpu::feature (Cpu::FEAT_MWAIT_EXT) ? "+E" : "",
            Cpu::feature (Cpu::FEAT_MWAIT_IRQ) ? "+I" : "");
 
-    if (!resume)
+    if (!resume) {
+        node[Cpu::id] = static_cast<uint8>(Numa::node_of_apic (apic_id[Cpu::id]));
         Hip::add_cpu();
+    }
 
     if (Cpu::feature (Cpu::FEAT_RDTSCP))
         Msr::write<uint64>(Msr::IA32_TSC_AUX, Cpu::id);
@@ -28,6 +28,7 @@
 #include "stdio.hpp"
 #include "svm.hpp"
 #include "vmx.hpp"
+#include "vm_policy.hpp"
 #include "vtlb.hpp"
 #include "sm.hpp"
 #include "pt.hpp"
@@ -37,6 +38,7 @@ Ec *Ec::current, *Ec::fpowner, *Ec::ec_idle;
 Sm *Ec::auth_suspend;
 
 uint64 Ec::killed_time[NUM_CPU];
+unsigned Ec::halt_stat[NUM_CPU][Ec::HALT_POLL_STATS];
 
 // Constructors
 Ec::Ec (Pd *own, void (*f)(), unsigned c) : Kobject (EC, static_cast<Space_obj *>(own)), cont (f), pd (own), cpu (static_cast<uint16>(c)), glb (true), evt (0), timeout (this)
@@ -44,6 +46,7 @@ Ec::Ec (Pd *own, void (*f)(), unsigned c) : Kobject (EC, static_cast<Space_obj *
     trace (TRACE_SYSCALL, "EC:%p created (PD:%p Kernel)", this, own);
 
     regs.vtlb = nullptr;
+    regs.vtlb_cache = nullptr;
     regs.vmcs_state = nullptr;
     regs.vmcb_state = nullptr;
 }
@@ -54,6 +57,7 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
     pd->Space_mem::init (pd->quota, c);
 
     regs.vtlb = nullptr;
+    regs.vtlb_cache = nullptr;
     regs.vmcs_state = nullptr;
     regs.vmcb_state = nullptr;
 
@@ -88,6 +92,12 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
 
         regs.dst_portal = VM_EXIT_STARTUP;
         regs.vtlb = new (pd->quota) Vtlb;
+        regs.vtlb_pd = pd;
+        Atomic::add (pd->vcpus, 1U);
+
+        // An empty root counts as completely flushed
+        if (pd->vtlb_track)
+            pd->vtlb_track->sync (&regs);
         regs.fpu_on = !Cmdline::fpu_lazy;
 
         if (Hip::feature() & Hip::FEAT_VMX) {
@@ -103,6 +113,12 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
 
             regs.vmcs_state->make_current();
 
+            if (Vmcs::has_posted())
+                regs.vmcs_state->pi = static_cast<Pi_desc *>(Buddy::phys_to_ptr (Vmcs::read (Vmcs::PI_DESC_ADDR)));
+
+            if (Vmcs::has_pml())
+                regs.vmcs_state->pml = static_cast<Pml_log *>(Buddy::phys_to_ptr (Vmcs::read (Vmcs::PML_ADDR)));
+
             regs.nst_ctrl<Vmcs>();
 
             regs.vmcs_state->clear();
@@ -111,11 +127,8 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
             trace (TRACE_SYSCALL, "EC:%p created (PD:%p VMCS:%p VTLB:%p)", this, p, regs.vmcs_state, regs.vtlb);
 
         } else if (Hip::feature() & Hip::FEAT_SVM) {
-            if (pd->asid == Space_mem::NO_ASID_ID)
-                pd->asid = Space_mem::asid_alloc.alloc();
-
             auto vmcb = new (pd->quota) Vmcb (pd->quota, pd->Space_pio::walk(pd->quota),
-                                              pd->npt.root(pd->quota), unsigned(pd->asid));
+                                              pd->npt.root(pd->quota));
 
             regs.vmcb_state = new (pd->quota) Vmcb_state(*vmcb, cpu);
 
@@ -138,6 +151,7 @@ Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone) : Kobject (EC, stati
     pd->Space_mem::init (pd->quota, c);
 
     regs.vtlb = nullptr;
+    regs.vtlb_cache = nullptr;
     regs.vmcs_state = nullptr;
     regs.vmcb_state = nullptr;
 
@@ -164,6 +178,7 @@ Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone, Pt *pt) : Kobject (E
     pd->Space_mem::init (pd->quota, c);
 
     regs.vtlb = nullptr;
+    regs.vtlb_cache = nullptr;
     regs.vmcs_state = nullptr;
     regs.vmcb_state = nullptr;
 
@@ -209,6 +224,20 @@ Ec::~Ec()
     /* vCPU cleanup */
     Vtlb::destroy(regs.vtlb, pd->quota);
 
+    if (regs.vtlb_cache)
+        Vtlb_cache::destroy(regs.vtlb_cache, pd->quota, Vtlb::levels (regs.vtlb_lm) - 1);
+
+    if (pd->vtlb_track)
+        pd->vtlb_track->detach (&regs);
+    else
+        Atomic::sub (pd->vcpus, 1U);
+
+    if (policy)
+        Vm_policy::destroy(policy, pd->quota);
+
+    if (profile)
+        Vm_profile::destroy(profile, pd->quota);
+
     if ((Hip::feature() & Hip::FEAT_VMX) && regs.vmcs_state) {
         regs.vmcs_state->clear();
         Vmcs_state::destroy(regs.vmcs_state, pd->quota);
@@ -220,6 +249,75 @@ Ec::~Ec()
     }
 }
 
+/*
+ * A vCPU spinning on PAUSE likely waits for a lock held by a preempted vCPU
+ * of the same VM. Give up the CPU, preferably to such a vCPU.
+ */
+void Ec::pause_yield (void (*func)())
+{
+    current->pause_exits++;
+
+    if (Sc::boost (current->pd))
+        current->pause_yields++;
+
+    current->cont = func;
+    Sc::schedule (false, false);
+}
+
+/*
+ * Spin on a guest HLT of a VMX vCPU for up to its polling window, waiting
+ * for a posted interrupt the guest would take right away. Returns true if one
+ * arrived, in which case the HLT completes without a round trip through the
+ * VMM. A recall or any interrupt for the host ends the poll early, then the
+ * HLT goes to the VMM unchanged.
+ */
+bool Ec::halt_poll()
+{
+    Ec *ec = current;
+
+    if (ec->halt_window && ec->regs.vmcs_state->apicv) {
+
+        uint64 const end = rdtsc() + ec->halt_window;
+
+        do {
+            if (ec->regs.vmcs_state->deliverable()) {
+                halt_stat[Cpu::id][HALT_POLL_HIT]++;
+                return true;
+            }
+
+            if (Lapic::pending() || ec->regs.hazard() & HZD_RECALL)
+                break;
+
+            pause();
+
+        } while (rdtsc() < end);
+
+        halt_stat[Cpu::id][HALT_POLL_MISS]++;
+    }
+
+    ec->halt_tsc = rdtsc();
+
+    return false;
+}
+
+/*
+ * Tune the polling window from how long the vCPU stayed blocked in the VMM
+ * after a HLT that polling did not catch. A short block means a longer poll
+ * would have caught the wakeup, a long one means polling is wasted.
+ */
+void Ec::halt_adapt()
+{
+    uint64 const min = static_cast<uint64>(Lapic::freq_tsc / 1000) * HALT_POLL_MIN_US;
+    uint64 const max = static_cast<uint64>(Lapic::freq_tsc / 1000) * HALT_POLL_MAX_US;
+
+    if (rdtsc() - halt_tsc <= max)
+        halt_window = ::min (::max (halt_window * 2, min), max);
+    else if ((halt_window /= 2) < min)
+        halt_window = 0;
+
+    halt_tsc = 0;
+}
+
 void Ec::handle_hazard (mword hzd, void (*func)())
 {
     if (hzd & HZD_RCU)
@@ -349,13 +447,46 @@ void Ec::ret_user_vmresume()
         if (current->regs.nst_on)
             Pd::current->ept.flush();
         else
-            current->regs.vtlb->flush (true);
+            current->regs.tlb_flush<Vmcs> (true);
+    }
+
+    current->regs.vmcs_state->load_vpid();
+
+    if (EXPECT_FALSE (current->regs.pdpte_ld))
+        current->regs.load_pdpte<Vmcs>();
+
+#ifdef __x86_64__
+    if (EXPECT_FALSE (!current->regs.nst_on && current->regs.vtlb_lm != !!(current->regs.guest_efer() & Cpu::EFER_LMA)))
+        Vtlb::depth (&current->regs, !current->regs.vtlb_lm);
+#endif
+
+    if (EXPECT_FALSE (current->regs.vmcs_state->pml && current->regs.vmcs_state->pml_on != Pd::current->logging)) {
+        current->regs.vmcs_state->pml_on = Pd::current->logging;
+        current->regs.vmx_set_cpu_ctrl1 (Vmcs::read (Vmcs::CPU_EXEC_CTRL1));
     }
 
     if (EXPECT_FALSE (get_cr2() != current->regs.cr2))
         set_cr2 (current->regs.cr2);
 
-    Fpu::State_xsv::make_current (Fpu::hst_xsv, current->regs.gst_xsv);    // Restore XSV guest state
+    current->regs.vmcs_state->guest.invalidate();
+
+    if (EXPECT_FALSE (current->regs.vmcs_state->eoi_on))
+        current->regs.vmcs_state->sync_eoi();
+
+    if (EXPECT_FALSE (current->regs.vmcs_state->apicv && current->regs.vmcs_state->pi->pending()))
+        current->regs.vmcs_state->sync_posted();
+
+    if (EXPECT_TRUE (Vmcs::has_preempt()))
+        Vmcs::set_preempt (Timeout_budget::budget.deadline());
+
+    if (EXPECT_FALSE (current->halt_tsc))
+        current->halt_adapt();
+
+    current->profile_entry();
+
+    Fpu::State_xsv::make_guest (current->regs.gst_xsv);                     // Restore XSV guest state
+
+    Rcu::eqs_enter();
 
     asm volatile ("lea %0," EXPAND (PREG(sp); LOAD_GPR)
                   "vmresume;"
@@ -363,7 +494,9 @@ void Ec::ret_user_vmresume()
                   "mov %1," EXPAND (PREG(sp);)
                   : : "m" (current->regs), "i" (CPU_LOCAL_STCK + PAGE_SIZE) : "memory");
 
-    Fpu::State_xsv::make_current (current->regs.gst_xsv, Fpu::hst_xsv);    // Restore XSV host state
+    Rcu::eqs_exit();
+
+    Fpu::State_xsv::make_current (Fpu::hst_xsv);                            // Restore XSV host state
 
     trace (0, "VM entry failed with error %#lx", Vmcs::read (Vmcs::VMX_INST_ERROR));
 
@@ -381,12 +514,28 @@ void Ec::ret_user_vmrun()
     if (EXPECT_FALSE (Pd::current->gtlb.chk (Cpu::id))) {
         Pd::current->gtlb.clr (Cpu::id);
         if (current->regs.nst_on)
-            current->regs.vmcb_state->vmcb.tlb_control = 1;
+            Tlb_tag<Vmcb>::drop_all();
         else
-            current->regs.vtlb->flush (true);
+            current->regs.tlb_flush<Vmcb> (true);
     }
 
-    Fpu::State_xsv::make_current (Fpu::hst_xsv, current->regs.gst_xsv);    // Restore XSV guest state
+#ifdef __x86_64__
+    if (EXPECT_FALSE (!current->regs.nst_on && current->regs.vtlb_lm != !!(current->regs.guest_efer() & Cpu::EFER_LMA)))
+        Vtlb::depth (&current->regs, !current->regs.vtlb_lm);
+#endif
+
+    current->regs.vmcb_state->load_asid();
+
+    current->regs.vmcb_state->prepare_vmrun();
+
+    if (EXPECT_FALSE (current->halt_tsc))
+        current->halt_adapt();
+
+    current->profile_entry();
+
+    Fpu::State_xsv::make_guest (current->regs.gst_xsv);                     // Restore XSV guest state
+
+    Rcu::eqs_enter();
 
     asm volatile ("lea %0," EXPAND (PREG(sp); LOAD_GPR)
                   "clgi;"
@@ -414,8 +563,17 @@ void Ec::idle()
         if (EXPECT_FALSE (hzd))
             handle_hazard (hzd, idle);
 
+        // Drain chunked RCU callbacks before sleeping, accepting interrupts in between
+        if (EXPECT_FALSE (Rcu::backlog())) {
+            Rcu::update (false);
+            Cpu::preemption_point();
+            continue;
+        }
+
         uint64 t1 = rdtsc();
 
+        Rcu::eqs_enter();
+
         Cpu::halt_or_mwait([&]() {
             asm volatile ("sti; hlt; cli" : : : "memory");
         }, [&](auto const cstate_hint) {
@@ -424,6 +582,8 @@ void Ec::idle()
             asm volatile ("sti; mwait; cli;" :: "a"(cstate_hint), "c"(0) : "memory");
         });
 
+        Rcu::eqs_exit();
+
         uint64 t2 = rdtsc();
 
         Counter::cycles_idle += t2 - t1;
@@ -567,6 +727,7 @@ void Ec::xcpu_clone(Ec & from, uint16 const tcpu)
 
     regs            = from.regs;
     regs.vtlb       = nullptr;
+    regs.vtlb_cache = nullptr;
     regs.vmcs_state = nullptr;
     regs.vmcb_state = nullptr;
 
@@ -613,8 +774,12 @@ void Ec::xcpu_revert(void (*sm_cont)())
 
 void Ec::idl_handler()
 {
-    if (Ec::current->cont == Ec::idle)
+    if (Ec::current->cont == Ec::idle || Rcu::expedite_pending())
         Rcu::update(false);
+
+    /* report the quiescent state on the way back to user mode */
+    if (Rcu::expedite_pending())
+        Cpu::hazard |= HZD_RCU;
 }
 
 void Ec::hlt_prepare()
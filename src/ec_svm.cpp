@@ -19,7 +19,9 @@
  */
 
 #include "ec.hpp"
+#include "rcu.hpp"
 #include "svm.hpp"
+#include "vm_policy.hpp"
 #include "vtlb.hpp"
 
 uint8 Ec::ifetch (mword virt)
@@ -77,6 +79,7 @@ void Ec::svm_exception (mword reason)
 
                 case Vtlb::GLA_GPA:
                     vmcb.cr2 = cr2;
+                    current->regs.vmcb_state->mark (Vmcb::CLEAN_CR2);
                     vmcb.inj_control = static_cast<uint64>(err) << 32 | 0x80000b0e;
 
                     [[fallthrough]];
@@ -164,9 +167,34 @@ void Ec::svm_cr(mword const reason)
     ret_user_vmrun();
 }
 
+void Ec::svm_policy (unsigned r)
+{
+    Vm_policy *policy = current->policy;
+    Vmcb &vmcb = current->regs.vmcb_state->vmcb;
+
+    mword ax = static_cast<mword>(vmcb.rax);
+
+    if (!policy || !policy->emulate (Vm_policy::Reason (r), ax, current->regs.REG(cx),
+                                     current->regs.REG(dx), current->regs.REG(bx), current->regs.tsc_offset))
+        return;
+
+    vmcb.rax = ax;
+    vmcb.adjust_rip (2);    // 0f a2, 0f 31, 0f 32
+    ret_user_vmrun();
+}
+
+void Ec::svm_pause()
+{
+    if (!current->regs.ple_on || current->regs.pause_vmm)
+        return;
+
+    current->regs.vmcb_state->vmcb.adjust_rip (2);    // f3 90
+    pause_yield (ret_user_vmrun);
+}
+
 void Ec::handle_svm()
 {
-    Fpu::State_xsv::make_current (current->regs.gst_xsv, Fpu::hst_xsv);    // Restore XSV host state
+    Rcu::eqs_exit();
 
     Vmcb &vmcb = current->regs.vmcb_state->vmcb;
 
@@ -196,8 +224,10 @@ void Ec::handle_svm()
     }
 
     /* sanity check, the array has solely NUM_VMI elements */
-    if (reason < NUM_VMI)
+    if (reason < NUM_VMI) {
         Counter::vmi[reason]++;
+        current->profile_exit (reason);
+    }
 
     switch (reason) {
 
@@ -218,6 +248,22 @@ void Ec::handle_svm()
         case 0x79:              // INVLPG
             if (!current->regs.nst_on) svm_invlpg();
             else break;
+
+        case 0x6e:              // RDTSC
+            svm_policy (Vm_policy::RDTSC);
+            break;
+
+        case 0x72:              // CPUID
+            svm_policy (Vm_policy::CPUID);
+            break;
+
+        case 0x7c:              // MSR
+            if (!vmcb.exitinfo1) svm_policy (Vm_policy::RDMSR);
+            break;
+
+        case 0x77:              // PAUSE
+            svm_pause();
+            break;
     }
 
     current->regs.dst_portal = reason;
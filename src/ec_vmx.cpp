@@ -22,7 +22,9 @@
 #include "ec.hpp"
 #include "gsi.hpp"
 #include "lapic.hpp"
+#include "rcu.hpp"
 #include "vectors.hpp"
+#include "vm_policy.hpp"
 #include "vmx.hpp"
 #include "vtlb.hpp"
 
@@ -194,9 +196,40 @@ void Ec::vmx_cr()
     ret_user_vmresume();
 }
 
+void Ec::vmx_policy (unsigned r)
+{
+    Vm_policy *policy = current->policy;
+
+    if (!policy || !policy->emulate (Vm_policy::Reason (r), current->regs.REG(ax), current->regs.REG(cx),
+                                     current->regs.REG(dx), current->regs.REG(bx), current->regs.tsc_offset))
+        return;
+
+    Vmcs::adjust_rip();
+    ret_user_vmresume();
+}
+
+void Ec::vmx_pause()
+{
+    /* unconditional PAUSE exiting was requested by the VMM */
+    if (!current->regs.ple_on || Vmcs::read (Vmcs::CPU_EXEC_CTRL0) & Vmcs::CPU_PAUSE)
+        return;
+
+    Vmcs::adjust_rip();
+    pause_yield (ret_user_vmresume);
+}
+
+void Ec::vmx_hlt()
+{
+    if (!halt_poll())
+        return;
+
+    Vmcs::adjust_rip();
+    ret_user_vmresume();
+}
+
 void Ec::handle_vmx()
 {
-    Fpu::State_xsv::make_current (current->regs.gst_xsv, Fpu::hst_xsv);    // Restore XSV host state
+    Rcu::eqs_exit();
 
     Cpu::hazard = (Cpu::hazard | HZD_DS_ES | HZD_TR) & ~HZD_FPU;
 
@@ -204,6 +237,11 @@ void Ec::handle_vmx()
 
     Counter::vmi[reason]++;
 
+    current->profile_exit (reason);
+
+    if (current->regs.vmcs_state->pml_on)
+        current->regs.vmcs_state->drain_pml (*Pd::current->dirty);
+
     switch (reason) {
         case Vmcs::VMX_EXC_NMI:     vmx_exception();
         case Vmcs::VMX_EXTINT:      vmx_extint();
@@ -211,6 +249,13 @@ void Ec::handle_vmx()
             if (!current->regs.nst_on) vmx_invlpg();
             else break;
         case Vmcs::VMX_CR:          vmx_cr();
+        case Vmcs::VMX_CPUID:       vmx_policy (Vm_policy::CPUID); break;
+        case Vmcs::VMX_RDTSC:       vmx_policy (Vm_policy::RDTSC); break;
+        case Vmcs::VMX_RDMSR:       vmx_policy (Vm_policy::RDMSR); break;
+        case Vmcs::VMX_PAUSE:       vmx_pause(); break;
+        case Vmcs::VMX_HLT:         vmx_hlt(); break;
+        case Vmcs::VMX_PML_FULL:    ret_user_vmresume();
+        case Vmcs::VMX_PREEMPT:     Timeout::check(); ret_user_vmresume();
         case Vmcs::VMX_EPT_VIOLATION:
             current->regs.nst_error = Vmcs::read (Vmcs::EXI_QUALIFICATION);
             current->regs.nst_fault = Vmcs::read (Vmcs::INFO_PHYS_ADDR);
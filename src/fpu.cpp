@@ -22,6 +22,9 @@
 #include "fpu.hpp"
 
 Fpu::State_xsv Fpu::hst_xsv;
+Fpu::State_xsv Fpu::cur_xsv[NUM_CPU];
+
+unsigned Fpu::xsv_stat[NUM_CPU][XSV_STATS];
 
 ALIGNED(Fpu::alignment) static Fpu empty;
 
@@ -32,6 +35,9 @@ void Fpu::init()
 
 void Fpu::save()
 {
+    // XSAVE must cover all managed components, not just those of a guest
+    State_xsv::make_current (hst_xsv);
+
 #ifdef __x86_64__
     if (Cpu::feature (Cpu::FEAT_XSAVE)) {
         if (compact && !no_compact)
@@ -66,6 +72,8 @@ void Fpu::load()
 {
     bool bad = false;
 
+    State_xsv::make_current (hst_xsv);
+
 #ifdef __x86_64__
     if (Cpu::feature (Cpu::FEAT_XSAVE))
         if (compact && !no_compact)
@@ -109,6 +117,8 @@ void Fpu::probe()
     // Enable user state components in XCR0
     set_xcr (0, hst_xsv.xcr);
 
+    cur_xsv[Cpu::id] = hst_xsv;
+
     unsigned size = 0, dummy = 0; 
     Cpu::cpuid (0xd, compact, dummy, size, dummy, dummy);
 
@@ -26,6 +26,7 @@
 #include "iommu_amd.hpp"
 #include "keyb.hpp"
 #include "lapic.hpp"
+#include "rcu.hpp"
 #include "sm.hpp"
 #include "vectors.hpp"
 
@@ -89,6 +90,8 @@ void Gsi::unmask (unsigned gsi)
 
 void Gsi::vector (unsigned vector)
 {
+    Rcu::eqs_exit();
+
     unsigned gsi = vector - VEC_GSI;
 
     if (gsi == Keyb::gsi)
@@ -30,6 +30,7 @@
 #include "pd.hpp"
 #include "acpi_rsdp.hpp"
 #include "acpi.hpp"
+#include "numa.hpp"
 #include "string.hpp"
 
 extern char _mempool_e;
@@ -78,16 +79,38 @@ void Hip::build (mword magic, mword addr)
 
     h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
 
+    Acpi::numa();
+
     uint64 const system_mem_max = system_memory(*h);
+    uint64 const target         = kernel_target_size(system_mem_max);
     uint64     memory_allocated = 0;
 
-    add_buddy (mem, h, system_mem_max, memory_allocated, true);
+    /* each node gets its share of kernel memory, starting with the one of the hypervisor */
+    unsigned const nodes = max (Numa::nodes, 1U);
+    unsigned const home  = Numa::node_of_phys (reinterpret_cast<mword>(&LINK_E));
+    uint64   const share = static_cast<uint64>(static_cast<mword>(target >> PAGE_BITS) / nodes) << PAGE_BITS;
+
+    add_buddy (mem, h, share, memory_allocated, true, home);
     h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
 
-    if (memory_allocated < kernel_target_size(system_mem_max)) {
-        add_buddy (mem, h, system_mem_max, memory_allocated, false);
+    for (unsigned n = 0; n < Numa::nodes; n++) {
+        if (n == home)
+            continue;
+
+        uint64 node_allocated = 0;
+        add_buddy (mem, h, share, node_allocated, false, n);
+        h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
+
+        memory_allocated += node_allocated;
+    }
+
+    if (memory_allocated < target) {
+        add_buddy (mem, h, target, memory_allocated, false, Numa::ANY);
         h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
     }
+
+    add_numa (mem);
+    h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
 }
 
 void Hip::build_mbi1(Hip_mem *&mem, mword addr)
@@ -237,7 +260,8 @@ void Hip::add_cpu()
     cpu->core     = Cpu::core[Cpu::id];
     cpu->thread   = Cpu::thread[Cpu::id];
     cpu->flags    = 1u | ((Cpu::core_type[Cpu::id] == Cpu::INTEL_CORE) ? 2u :
-                          (Cpu::core_type[Cpu::id] == Cpu::INTEL_ATOM) ? 4u : 0u);
+                          (Cpu::core_type[Cpu::id] == Cpu::INTEL_ATOM) ? 4u : 0u) |
+                    static_cast<uint8>(Cpu::node[Cpu::id] << 4);
     cpu->family   = Cpu::family[Cpu::id];
     cpu->model    = Cpu::model[Cpu::id];
     cpu->stepping = Cpu::stepping[Cpu::id] & 0xf;
@@ -284,6 +308,34 @@ void Hip::add_check()
     h->checksum = c;
 }
 
+/*
+ * Export the memory ranges of each node and the distances between nodes
+ */
+void Hip::add_numa (Hip_mem *&mem)
+{
+    if (Numa::nodes < 2)
+        return;
+
+    Numa::for_each_range (Numa::ANY, [&] (uint64 lo, uint64 hi, unsigned n) {
+        mem->addr = lo;
+        mem->size = hi - lo;
+        mem->type = Hip_mem::NUMA_MEM;
+        mem->aux  = n;
+        mem++;
+    });
+
+    for (unsigned n = 0; n < Numa::nodes; n++) {
+        mem->addr = 0;
+        for (unsigned i = 0; i < Numa::nodes; i++)
+            mem->addr |= uint64 (Numa::dist[n][i]) << (i * 8);
+
+        mem->size = Numa::proximity (n);
+        mem->type = Hip_mem::NUMA_NODE;
+        mem->aux  = n;
+        mem++;
+    }
+}
+
 uint64 Hip::system_memory (Hip &hip)
 {
     uint64 system_mem_max = 0;
@@ -297,8 +349,8 @@ uint64 Hip::system_memory (Hip &hip)
     return system_mem_max;
 }
 
-void Hip::add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
-                     uint64 &memory_allocated, bool close)
+void Hip::add_buddy (Hip_mem *&mem, Hip * hip, uint64 const target,
+                     uint64 &memory_allocated, bool close, unsigned node)
 {
     mword const mhv_end = reinterpret_cast<mword>(&LINK_E);
     bool done = false;
@@ -307,24 +359,33 @@ void Hip::add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
         if (done || (m.type != MEMORY_AVAIL))
             return;
 
-        uint64 const memory_before = memory_allocated;
-
         /* find memory close behind hypervisor for close = true */
-        if (!close || (m.addr <= mhv_end && mhv_end < m.addr + m.size))
-            _add_buddy(mem, hip, system_mem_max, memory_allocated, m);
+        if (close && !(m.addr <= mhv_end && mhv_end < m.addr + m.size))
+            return;
+
+        /* a buddy never spans more than one node */
+        Numa::for_each_range (node, [&] (uint64 lo, uint64 hi, unsigned n) {
+            if (done)
+                return;
+
+            uint64 const memory_before = memory_allocated;
+
+            _add_buddy(mem, hip, target, memory_allocated, m, lo, hi, n);
 
-        done = (memory_before != memory_allocated);
+            done = (memory_before != memory_allocated);
+        });
     });
 }
 
-void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
-                      uint64 &memory_allocated, Hip_mem const &cmp)
+void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const target,
+                      uint64 &memory_allocated, Hip_mem const &cmp,
+                      uint64 const lo, uint64 const hi, unsigned node)
 {
     enum { MEMORY_AVAIL = 1 };
 
     mword const mhv_end = reinterpret_cast<mword>(&LINK_E);
-    uint64 region_start = mhv_end;
-    uint64 region_end   = cmp.addr + cmp.size;
+    uint64 region_start = max (uint64 (mhv_end), lo);
+    uint64 region_end   = min (cmp.addr + cmp.size, hi);
 
     if (region_end <= region_start)
          return;
@@ -381,7 +442,7 @@ void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
     if (v_buddy + region_size >= BUDDY_V_MAX)
         region_size = (BUDDY_V_MAX - v_buddy);
 
-    uint64 system_mem = kernel_target_size(system_mem_max);
+    uint64 system_mem = target;
     if (memory_allocated < system_mem)
         system_mem -= memory_allocated;
 
@@ -400,11 +461,12 @@ void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
     memset(reinterpret_cast<void *>(v_buddy), 0, static_cast<mword>(buddy_size));
 
     /* allocate new buddy */
-    new (Pd::kern.quota) Buddy(buddy_start, v_buddy, v_buddy, static_cast<mword>(buddy_size));
+    new (Pd::kern.quota) Buddy(buddy_start, v_buddy, v_buddy, static_cast<mword>(buddy_size), node);
 
     mem->addr = buddy_start;
     mem->size = buddy_size;
     mem->type = Hip_mem::HYPERVISOR;
+    mem->aux  = node;
     mem++;
 
     memory_allocated += buddy_size;
@@ -19,10 +19,13 @@
 #include "iommu_amd.hpp"
 #include "iommu_intel.hpp"
 #include "lapic.hpp"
+#include "rcu.hpp"
 #include "vectors.hpp"
 
 void Iommu::Interface::vector (unsigned vector)
 {
+    Rcu::eqs_exit();
+
     unsigned msi = vector - VEC_MSI;
 
     if (EXPECT_TRUE (msi == 0)) {
@@ -55,11 +58,11 @@ void Iommu::Interface::release (uint16 const rid, Pd * const pd)
         Iommu::Amd::release(rid, pd);
 }
 
-void Iommu::Interface::flush_pgt(uint16 const rid, Pd &pd)
+void Iommu::Interface::flush_pgt(uint16 const rid, Pd &pd, Flush const &flush)
 {
     if (Dmar::online())
-        Dmar::flush_pgt(rid, pd);
+        Dmar::flush_pgt(rid, pd, flush);
 
     if (Iommu::Amd::online())
-        Iommu::Amd::flush_pgt(rid, pd);
+        Iommu::Amd::flush_pgt(rid, pd, flush);
 }
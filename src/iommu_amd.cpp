@@ -135,6 +135,8 @@ void Iommu::Amd::start()
 
         write<uint64>(REG_CMD, base);
 
+        cmd_tail = ring_mask(read<uint64>(REG_CMD_TAIL));
+
         ctrl |= 1ULL << 12 /* enable */;
     }
 
@@ -246,8 +248,10 @@ void Iommu::Amd::assign (uint16 const rid, Pd * const p)
     entry->dma_enable();
     entry->enable();
 
+    static Flush const domain { };
+
     flush_dte(rid, false);
-    flush_pgt(*p);
+    flush_pgt(*p, domain);
 }
 
 static Iommu::Amd * lookup (uint16 const rid)
@@ -362,64 +366,62 @@ void Iommu::Amd::set_irt(unsigned, unsigned rid, unsigned cpu, unsigned vec, uns
     iommu->flush_dte(rid, true);
 }
 
-void Iommu::Amd::flush(unsigned const rid, unsigned const type, bool const wait)
+void Iommu::Amd::cmd_wait()
 {
-    if (!cmd_base) return;
-
-    uint64 tail = ring_mask(read<uint64>(REG_CMD_TAIL));
-    uint64 const ring_size = 1ull << (12 + EVENT_ORDER);
+    uint64 const seq = ++cmd_seq;
 
-    uint64 *inv = reinterpret_cast<uint64 *>(cmd_base + tail);
-    *inv = (uint64(type) << 60) | uint64(rid & 0xffffu);
-    *(++inv) = 0ull;
-    tail = (tail + 16) % ring_size;
-
-    if (wait) {
-        inv = reinterpret_cast<uint64 *>(cmd_base + tail);
-
-        *inv = (1ull /* cmd wait */ << 60);
-        *(++inv) = 0ull;
-        tail = (tail + 16) % ring_size;
-    }
+    /* completion wait, store seq to cmd_done */
+    uint64 const phys = Buddy::ptr_to_phys (&cmd_done);
+    cmd_submit ((1ull << 60) | (phys & 0xffffffffffff8ull) | 1, seq);
 
     barrier();
 
-    write<uint64>(REG_CMD_TAIL, tail);
+    write<uint64>(REG_CMD_TAIL, cmd_tail);
 
     if (!Lapic::pause_loop_until(500, [&] {
-      return (ring_mask(read<uint64>(REG_CMD_HEAD)) != tail);
+      return ACCESS_ONCE (cmd_done) != seq;
     }))
-      trace(TRACE_IOMMU, "timeout - iommu flush");
+      trace(TRACE_IOMMU, "timeout - iommu cmd wait");
 }
 
-void Iommu::Amd::flush_pgt (Pd &p)
+void Iommu::Amd::flush(unsigned const rid, unsigned const type, bool const wait)
 {
     if (!cmd_base) return;
 
-    uint64 tail = ring_mask(read<uint64>(REG_CMD_TAIL));
-    uint64 const ring_size = 1ull << (12 + EVENT_ORDER);
+    cmd_submit ((uint64(type) << 60) | uint64(rid & 0xffffu), 0);
 
-    uint64 *inv = reinterpret_cast<uint64 *>(cmd_base + tail);
-    inv[0] = (3ull /* flush pgt */ << 60) | (uint64(p.dom_id) & 0xffffull) << 32;
-    inv[1] = (0x7FFFFFFFFFFFFull << 12) | 2 | 1;
-    tail = (tail + 16) % ring_size;
+    if (wait)
+        cmd_wait();
+}
 
-    barrier();
+void Iommu::Amd::flush_pgt (Pd &p, Flush const &f)
+{
+    if (!cmd_base) return;
 
-    write<uint64>(REG_CMD_TAIL, tail);
+    uint64 const cmd = (3ull /* flush pgt */ << 60) | (uint64(p.dom_id) & 0xffffull) << 32;
 
-    if (!Lapic::pause_loop_until(500, [&] {
-      return (ring_mask(read<uint64>(REG_CMD_HEAD)) != tail);
-    }))
-      trace(TRACE_IOMMU, "timeout - iommu flush pgt");
+    if (!f.count)
+        cmd_submit (cmd, (0x7FFFFFFFFFFFFull << 12) | 2 | 1);
+
+    /* size encoded: the lowest clear address bit above bit 12 gives the size */
+    for (unsigned i = 0; i < f.count; i++) {
+        uint64 addr = uint64(f.range[i].base) << PAGE_BITS;
+
+        if (f.range[i].ord)
+            addr |= ((1ull << (f.range[i].ord - 1)) - 1) << PAGE_BITS | 1;
+
+        cmd_submit (cmd, addr | 2);
+    }
+
+    cmd_wait();
 }
 
-void Iommu::Amd::flush_pgt (uint16 const rid, Pd &p)
+void Iommu::Amd::flush_pgt (uint16 const rid, Pd &p, Flush const &f)
 {
     auto iommu = lookup(rid);
     if (!iommu) return;
 
     Lock_guard <Spinlock> guard (iommu->lock);
 
-    iommu->flush_pgt(p);
+    iommu->flush_pgt(p, f);
 }
@@ -176,12 +176,39 @@ static Dmar * lookup (uint16 const rid)
     return iommu;
 }
 
-void Dmar::flush_pgt (uint16 const rid, Pd &p)
+/*
+ * Invalidate the IOTLB of a domain after its page table changed. With queued
+ * invalidation, every range gets a page-selective descriptor and the batch is
+ * followed by a single wait. Otherwise, and for ranges beyond the largest
+ * address mask, the whole domain is flushed.
+ */
+void Dmar::flush_tlb (uint64 const did, Iommu::Flush const &f)
+{
+    if (!qi()) {
+        flush_ctx (Dmar_qi::Mode::FLUSH_BY_DID, did);
+        return;
+    }
+
+    bool domain = !f.count || !psi();
+
+    for (unsigned i = 0; !domain && i < f.count; i++)
+        domain = f.range[i].ord > mamv();
+
+    if (domain)
+        qi_submit (Dmar_qi_tlb (Dmar_qi::Mode::FLUSH_BY_DID, did));
+    else
+        for (unsigned i = 0; i < f.count; i++)
+            qi_submit (Dmar_qi_tlb (did, static_cast<uint64>(f.range[i].base) << PAGE_BITS, static_cast<unsigned>(f.range[i].ord)));
+
+    qi_wait();
+}
+
+void Dmar::flush_pgt (uint16 const rid, Pd &p, Iommu::Flush const &f)
 {
     auto iommu = lookup(rid);
     if (!iommu) return;
 
     Lock_guard <Spinlock> guard (iommu->lock);
 
-    iommu->flush_ctx(Dmar_qi::Mode::FLUSH_BY_DID, p.dom_id);
+    iommu->flush_tlb (p.dom_id, f);
 }
@@ -220,6 +220,8 @@ void Lapic::timer_handler()
 
 void Lapic::lvt_vector (unsigned vector)
 {
+    Rcu::eqs_exit();
+
     unsigned lvt = vector - VEC_LVT;
 
     switch (vector) {
@@ -237,6 +239,8 @@ void Lapic::lvt_vector (unsigned vector)
 
 void Lapic::ipi_vector (unsigned vector)
 {
+    Rcu::eqs_exit();
+
     unsigned ipi = vector - VEC_IPI;
 
     switch (vector) {
@@ -0,0 +1,105 @@
+/*
+ * Non-Uniform Memory Access (NUMA) topology
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "numa.hpp"
+#include "stdio.hpp"
+
+Numa::Range Numa::range[MAX_RANGES];
+uint32      Numa::domain[MAX_NODES];
+uint8       Numa::apic[MAX_APICS];
+unsigned    Numa::nodes;
+unsigned    Numa::ranges;
+uint8       Numa::dist[MAX_NODES][MAX_NODES];
+uint8       Numa::order[MAX_NODES][MAX_NODES];
+
+/*
+ * Map a proximity domain to a dense node number
+ */
+unsigned Numa::node (uint32 pxm)
+{
+    for (unsigned n = 0; n < nodes; n++)
+        if (domain[n] == pxm)
+            return n;
+
+    if (nodes == MAX_NODES)
+        return ANY;
+
+    domain[nodes] = pxm;
+
+    return nodes++;
+}
+
+void Numa::add_mem (uint32 pxm, uint64 base, uint64 size)
+{
+    unsigned n = node (pxm);
+
+    if (n == ANY || ranges == MAX_RANGES || !size)
+        return;
+
+    range[ranges].base = base;
+    range[ranges].size = size;
+    range[ranges].node = n;
+    ranges++;
+}
+
+void Numa::add_cpu (uint32 pxm, uint32 apic_id)
+{
+    unsigned n = node (pxm);
+
+    if (n != ANY && apic_id < MAX_APICS)
+        apic[apic_id] = static_cast<uint8>(n);
+}
+
+void Numa::set_distance (uint32 from, uint32 to, uint8 d)
+{
+    for (unsigned i = 0; i < nodes; i++)
+        for (unsigned j = 0; j < nodes; j++)
+            if (domain[i] == from && domain[j] == to)
+                dist[i][j] = d;
+}
+
+unsigned Numa::node_of_phys (uint64 phys)
+{
+    for (unsigned i = 0; i < ranges; i++)
+        if (range[i].base <= phys && phys - range[i].base < range[i].size)
+            return range[i].node;
+
+    return 0;
+}
+
+/*
+ * Fill in missing distances and sort the nodes of each row by distance,
+ * which is the fallback order of the buddy allocator
+ */
+void Numa::setup()
+{
+    for (unsigned i = 0; i < nodes; i++) {
+        for (unsigned j = 0; j < nodes; j++) {
+            if (!dist[i][j])
+                dist[i][j] = i == j ? LOCAL : REMOTE;
+
+            order[i][j] = static_cast<uint8>(j);
+        }
+
+        for (unsigned j = 1; j < nodes; j++)
+            for (unsigned k = j; k && dist[i][order[i][k]] < dist[i][order[i][k - 1]]; k--) {
+                uint8 t = order[i][k]; order[i][k] = order[i][k - 1]; order[i][k - 1] = t;
+            }
+    }
+
+    for (unsigned i = 0; i < ranges; i++)
+        trace (TRACE_MEMORY, "NUMA: %#010llx-%#010llx N:%u PXM:%u",
+               range[i].base, range[i].base + range[i].size, range[i].node, domain[range[i].node]);
+}
@@ -26,17 +26,26 @@
 #include "ec.hpp"
 #include "pt.hpp"
 #include "sm.hpp"
+#include "vtlb.hpp"
 
 INIT_PRIORITY (PRIO_SLAB)
 Slab_cache Pd::cache (sizeof (Pd), 32);
 
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::pt_arena  (sizeof (Pt),  32);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::mdb_arena (sizeof (Mdb), 16);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::sm_arena  (sizeof (Sm),  32);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::sc_arena  (sizeof (Sc),  32);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::ec_arena  (sizeof (Ec),  32);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Pd::fpu_arena (sizeof (Fpu), Fpu::alignment);
+
 Pd *Pd::current;
+Pd *Pd::dma_pend[NUM_CPU];
 
 INIT_PRIORITY (PRIO_SLAB)
 ALIGNED(32) Pd Pd::kern (&Pd::kern);
 ALIGNED(32) Pd Pd::root (&Pd::root, NUM_EXC, 0x1f);
 
-Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), pt_cache (sizeof (Pt), 32), mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), Fpu::alignment)
+Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), quota (nullptr), pt_cache (sizeof (Pt), 32, &pt_arena), mdb_cache (sizeof (Mdb), 16, &mdb_arena), sm_cache (sizeof (Sm), 32, &sm_arena), sc_cache (sizeof (Sc), 32, &sc_arena), ec_cache (sizeof (Ec), 32, &ec_arena), fpu_cache (sizeof (Fpu), Fpu::alignment, &fpu_arena)
 {
     hpt = Hptp (reinterpret_cast<mword>(&PDBR));
 
@@ -52,7 +61,7 @@ Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), pt_cache (sizeof
     Space_pio::addreg (own->quota, own->mdb_cache, 0, 1UL << 16, 7);
 }
 
-Pd::Pd (Pd *own, mword sel, mword a) : Kobject (PD, static_cast<Space_obj *>(own), sel, a, free, pre_free), pt_cache (sizeof (Pt), 32) , mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), Fpu::alignment)
+Pd::Pd (Pd *own, mword sel, mword a) : Kobject (PD, static_cast<Space_obj *>(own), sel, a, free, pre_free), quota (this != &Pd::root ? &own->quota : nullptr), pt_cache (sizeof (Pt), 32, &pt_arena), mdb_cache (sizeof (Mdb), 16, &mdb_arena), sm_cache (sizeof (Sm), 32, &sm_arena), sc_cache (sizeof (Sc), 32, &sc_arena), ec_cache (sizeof (Ec), 32, &ec_arena), fpu_cache (sizeof (Fpu), Fpu::alignment, &fpu_arena)
 {
     if (this == &Pd::root) {
         bool res = Quota::init.transfer_to(quota, Quota::init.limit());
@@ -141,14 +150,8 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
 
         /* keep in mapping database if requested and at least one child node exists */
         if (kim && (ACCESS_ONCE(mdb->next)->dpth > mdb->dpth)) {
-            Quota_guard qg(this->quota);
-            if (mdb->node_attr & 0x1f) {
-                if (mdb->node_sub & 0x1)
-                    Cpu::hazard |= HZD_IOMMU;
-
-                static_cast<S *>(mdb->space)->update (qg, mdb, 0x1f);
-                mdb->demote_node (0x1f);
-            }
+            if (mdb->node_attr & 0x1f)
+                downgrade<S> (mdb, 0x1f);
 
             bool preempt = Cpu::preemption;
             if (preempt)
@@ -172,14 +175,8 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
 
         for (Mdb *ptr;; node = ptr) {
 
-            if (demote && node->node_attr & attr) {
-                if (mdb->node_sub & 0x1)
-                    Cpu::hazard |= HZD_IOMMU;
-
-                Quota_guard qg(this->quota);
-                static_cast<S *>(node->space)->update (qg, node, attr);
-                node->demote_node (attr);
-            }
+            if (demote && node->node_attr & attr)
+                downgrade<S> (node, attr);
 
             ptr = ACCESS_ONCE (node->next);
 
@@ -219,11 +216,99 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
     }
 
     if (!Cpu::preemption && (Cpu::hazard & HZD_IOMMU)) {
-        this->flush_pgt();
+        flush_dma();
         Cpu::hazard &= ~unsigned(HZD_IOMMU);
     }
 }
 
+/*
+ * Downgrade a mapping in the space it lives in. The stale DMA translations
+ * get recorded there, so the PD of that space is the one to flush.
+ */
+template <typename S>
+void Pd::downgrade (Mdb *node, mword attr)
+{
+    Pd *pd = static_cast<Pd *>(static_cast<S *>(node->space));
+
+    bool eager   = (node->node_sub & 0x1) && !track_dma (pd);
+    bool preempt = eager && Cpu::preemption;
+
+    if (preempt)
+        Cpu::preempt_disable();
+
+    Quota_guard qg(this->quota);
+    static_cast<S *>(node->space)->update (qg, node, attr);
+    node->demote_node (attr);
+
+    /* a PD on its way out cannot be tracked, flush it right away */
+    if (eager)
+        pd->flush_pgt();
+
+    if (preempt)
+        Cpu::preempt_enable();
+}
+
+/*
+ * Note that a revoke on this CPU is about to leave stale DMA translations in
+ * the given PD. Only one PD is tracked per CPU, the previous one gets flushed.
+ * Kept across a restart of a preempted revoke, like HZD_IOMMU.
+ */
+bool Pd::track_dma (Pd *pd)
+{
+    bool preempt = Cpu::preemption;
+
+    if (preempt)
+        Cpu::preempt_disable();
+
+    Pd *old = dma_pend[Cpu::id];
+
+    bool ok = old == pd || pd->add_ref();
+
+    if (ok && old != pd) {
+        dma_pend[Cpu::id] = pd;
+
+        if (old) {
+            old->flush_pgt();
+
+            if (old->del_rcu())
+                Rcu::call (old);
+        }
+    }
+
+    if (ok)
+        Cpu::hazard |= HZD_IOMMU;
+
+    if (preempt)
+        Cpu::preempt_enable();
+
+    return ok;
+}
+
+/*
+ * Flush the PD tracked by the revokes on this CPU. Only a caller that has a
+ * semaphore to signal once the flush completed passes lazy. A lazy PD may
+ * then defer the flush and is handed to the caller, with a reference.
+ */
+void Pd::flush_dma (Pd **lazy)
+{
+    Pd *pd = dma_pend[Cpu::id];
+
+    if (!pd)
+        return;
+
+    dma_pend[Cpu::id] = nullptr;
+
+    if (lazy && pd->defer_pgt()) {
+        *lazy = pd;
+        return;
+    }
+
+    pd->flush_pgt();
+
+    if (pd->del_rcu())
+        Rcu::call (pd);
+}
+
 mword Pd::clamp (mword snd_base, mword &rcv_base, mword snd_ord, mword rcv_ord)
 {
     if ((snd_base ^ rcv_base) >> max (snd_ord, rcv_ord))
@@ -345,7 +430,7 @@ void Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot)
         shootdown(this);
 }
 
-void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim)
+void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim, Pd **lazy)
 {
     if (preempt)
         Cpu::preempt_enable();
@@ -372,7 +457,7 @@ void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim)
         Cpu::preempt_disable();
 
     if (Cpu::hazard & HZD_IOMMU) {
-        this->flush_pgt();
+        flush_dma (lazy);
         Cpu::hazard &= ~unsigned(HZD_IOMMU);
     }
 
@@ -380,7 +465,165 @@ void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim)
         shootdown(this);
 }
 
-void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long ti)
+/*
+ * Flushes of a PD run one at a time and are numbered. Deferred revokes and a
+ * held back semaphore only count as done once the flush that took their
+ * ranges completed.
+ */
+void Pd::flush_pgt()
+{
+    Lock_guard <Spinlock> serial (dma_flush);
+
+    unsigned batch;
+    uint64   gen;
+
+    {
+        Lock_guard <Spinlock> guard (dma_lock);
+
+        batch = dma_batch;
+        gen   = ++dma_gen;
+    }
+
+    Iommu::Flush flush;
+
+    dma_stale.take (flush);
+
+    for (unsigned i = 0; i < sizeof(rids) / sizeof(rids[0]); i++) {
+        if (rids_u & (1U << i))
+            Iommu::Interface::flush_pgt(rids[i], *this, flush);
+    }
+
+    Sm *sm = nullptr;
+
+    {
+        Lock_guard <Spinlock> guard (dma_lock);
+
+        dma_batch -= batch;
+
+        if (dma_sm && (dma_sm_gen <= gen || !dma_batch)) {
+            sm     = dma_sm;
+            dma_sm = nullptr;
+        }
+    }
+
+    if (!sm)
+        return;
+
+    sm->add_to_rcu();
+
+    if (sm->del_rcu())
+        Rcu::call (sm);
+}
+
+/*
+ * A PD in lazy mode leaves the IOMMU flush of a revoke pending until
+ * IOMMU_LAZY_BATCH revokes piled up or their ranges no longer fit, at the
+ * latest until the end of the next RCU grace period.
+ */
+bool Pd::defer_pgt()
+{
+    Lock_guard <Spinlock> guard (dma_lock);
+
+    if (!dma_lazy || ++dma_batch >= IOMMU_LAZY_BATCH || dma_stale.full())
+        return false;
+
+    if (dma_armed)
+        return true;
+
+    if (!add_ref())
+        return false;
+
+    dma_armed = true;
+
+    Rcu::call (&dma_timer);
+
+    return true;
+}
+
+void Pd::dma_expire (Rcu_elem *e)
+{
+    Pd *pd = static_cast<Dma_timer *>(e)->pd;
+
+    {
+        Lock_guard <Spinlock> guard (pd->dma_lock);
+
+        pd->dma_armed = false;
+    }
+
+    if (ACCESS_ONCE (pd->dma_batch))
+        pd->flush_pgt();
+
+    if (pd->del_rcu())
+        Rcu::call (pd);
+}
+
+/*
+ * Hold back the semaphore of a revoke whose IOMMU flush is still pending
+ * until that flush completed. The ranges of the revoke may already be taken
+ * by a flush in progress, so wait for the next one to be sure, or until no
+ * deferred revoke is left. A second semaphore flushes right away.
+ */
+bool Pd::defer_sm (Sm *sm)
+{
+    {
+        Lock_guard <Spinlock> guard (dma_lock);
+
+        if (!dma_batch)
+            return false;
+
+        if (dma_sm == sm || (!dma_sm && sm->add_ref())) {
+            dma_sm     = sm;
+            dma_sm_gen = dma_gen + 1;
+            return true;
+        }
+    }
+
+    flush_pgt();
+
+    return false;
+}
+
+void Pd::lazy_dma (bool on)
+{
+    dma_lazy = on;
+
+    if (!on && ACCESS_ONCE (dma_batch))
+        flush_pgt();
+}
+
+/*
+ * Widen a memory item sent in reply to a nested-page fault to the naturally
+ * aligned window of 2^ord pages around it, so that the neighbouring guest
+ * pages get mapped in one go. Only done if a single mapping of the sender
+ * backs the whole window at the same offset and the window is still empty
+ * in the receiver; otherwise the item is left as sent.
+ */
+void Pd::fault_around (Pd *snd, Crd &crd, mword hot, mword ord)
+{
+    mword sb = crd.base(), so = crd.order();
+
+    if (crd.type() != Crd::MEM || so >= ord)
+        return;
+
+    mword m = (1UL << ord) - 1;
+
+    if ((sb ^ hot) & m & ~((1UL << so) - 1))
+        return;
+
+    Mdb *src = snd->Space_mem::tree_lookup (sb & ~m);
+    if (!src || src->node_order < ord)
+        return;
+
+    Mdb *dst = Space_mem::tree_lookup (hot & ~m, true);
+    if (dst && dst->node_base <= (hot | m))
+        return;
+
+    trace (TRACE_DEL, "DEL FAR PD:%p->%p SB:%#010lx O:%#04lx->%#04lx", snd, this, sb, so, ord);
+
+    crd = Crd (Crd::MEM, sb & ~m, ord, crd.attr());
+}
+
+void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long ti, mword fa)
 {
     mword set_as_del;
 
@@ -406,6 +649,8 @@ void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long
 
             case 1: {
                 bool r = src == &root && s->flags() & 0x800;
+                if (fa)
+                    fault_around (r ? &kern : src, crd, s->hotspot(), fa);
                 del_crd (r? &kern : src, del, crd, (s->flags() >> 8) & (r ? 7 : 3), s->hotspot());
                 if (Cpu::hazard & HZD_OOM)
                     return;
@@ -449,6 +694,12 @@ void Pd::assign_rid(uint16 const r)
     rids_u     |= static_cast<uint16>(1U << free);
 }
 
+mword Pd::slab_pages()
+{
+    return pt_cache.pages() + mdb_cache.pages() + sm_cache.pages() + sc_cache.pages() + ec_cache.pages() + fpu_cache.pages() +
+           (quota.objects() + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
 Pd::~Pd()
 {
     pre_free(this);
@@ -463,6 +714,12 @@ Pd::~Pd()
 
     Space_mem::npt.clear(quota);
 
+    if (Space_mem::dirty)
+        Dirty_log::destroy(Space_mem::dirty, quota);
+
+    if (vtlb_track)
+        Vtlb_track::destroy(vtlb_track, quota);
+
     for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
         if (Hip::cpu_online (cpu))
             Space_mem::loc[cpu].clear(quota, Space_mem::hpt.dest_loc, Space_mem::hpt.iter_loc_lev);
@@ -151,6 +151,47 @@ void Pte<P,E,L,B,F,V>::free_up (Quota &quota, unsigned l, P * e, mword v, bool (
     }
 }
 
+/*
+ * Test and clear dirty bit d in the leaf entries covering n pages from v and
+ * set bit x + i in bitmap b if page i was dirty. A large page counts as dirty
+ * in all of its pages. Returns the number of dirty pages.
+ */
+template <typename P, typename E, unsigned L, unsigned B, bool F, bool V>
+unsigned long Pte<P,E,L,B,F,V>::collect (E d, E v, unsigned long n, mword *b, unsigned long x)
+{
+    unsigned long dirty = 0;
+
+    for (unsigned long i = 0, s; i < n; i += s) {
+
+        E a = v + (static_cast<E>(i) << PAGE_BITS);
+        unsigned long l = L;
+
+        P *e = static_cast<P *>(this);
+
+        if (EXPECT_FALSE (!e->val))
+            break;
+
+        do
+            e = static_cast<P *>(Buddy::phys_to_ptr (e->addr())) + (a >> (--l * B + PAGE_BITS) & ((1UL << B) - 1));
+        while (l && e->val && !e->super (l));
+
+        s = min ((1UL << l * B) - (static_cast<unsigned long>(a >> PAGE_BITS) & ((1UL << l * B) - 1)), n - i);
+
+        if (!e->present())
+            continue;
+
+        for (E o; (o = e->val) & d; )
+            if (e->set (o, o & ~d)) {
+                for (unsigned long j = x + i; j < x + i + s; j++)
+                    b[j / (sizeof (mword) * 8)] |= 1UL << j % (sizeof (mword) * 8);
+                dirty += s;
+                break;
+            }
+    }
+
+    return dirty;
+}
+
 template class Pte<Dpt, uint64, 4, 9, true, false>;
 template class Pte<Ipt, uint64, 4, 9, true, true>;
 template class Pte<Ept, uint64, 4, 9, false, false>;
@@ -20,6 +20,7 @@
 
 #include "atomic.hpp"
 #include "barrier.hpp"
+#include "cmdline.hpp"
 #include "counter.hpp"
 #include "cpu.hpp"
 #include "hazards.hpp"
@@ -29,9 +30,14 @@
 #include "hip.hpp"
 #include "lapic.hpp"
 #include "vectors.hpp"
+#include "util.hpp"
+#include "x86.hpp"
 
 mword   Rcu::state = RCU_CMP;
 mword   Rcu::count;
+mword   Rcu::expedite_batch;
+
+Rcu::Eqs Rcu::eqs[NUM_CPU];
 
 mword   Rcu::l_batch;
 mword   Rcu::c_batch;
@@ -40,15 +46,42 @@ INIT_PRIORITY (PRIO_LOCAL) Rcu_list Rcu::next;
 INIT_PRIORITY (PRIO_LOCAL) Rcu_list Rcu::curr;
 INIT_PRIORITY (PRIO_LOCAL) Rcu_list Rcu::done;
 
+/*
+ * Invoke the callbacks of completed batches. With the rcu_chunk option at
+ * most CHUNK of them, the rest stays queued for the next quiescent state.
+ */
 void Rcu::invoke_batch()
 {
-    for (Rcu_elem *e = done.head, *n = nullptr; n != done.head; e = n) {
-        n = e->next;
+    uint64 const t = rdtsc();
+
+    mword const limit = Cmdline::rcu_chunk ? mword (CHUNK) : ~0UL;
+    mword n = 0;
+
+    Rcu_elem *e = done.head;
+
+    for (bool last = false; !last && n < limit; n++) {
+        Rcu_elem *x = e->next;
+        last = x == done.head;
         e->next = nullptr;
         (e->func)(e);
+        e = x;
+    }
+
+    if (e == done.head)
+        done.clear();
+    else {
+        done.head  = e;
+       *done.tail  = e;
+        done.count = done.count > n ? done.count - n : 0;
     }
 
-    done.clear();
+    uint64 const c = rdtsc() - t;
+
+    Counter::rcu_batches++;
+    Counter::rcu_elems  += static_cast<unsigned>(n);
+    Counter::rcu_cycles += c;
+    Counter::rcu_max_len    = max (Counter::rcu_max_len, static_cast<unsigned>(n));
+    Counter::rcu_max_cycles = max (Counter::rcu_max_cycles, c);
 }
 
 void Rcu::start_batch (State s)
@@ -67,14 +100,70 @@ void Rcu::start_batch (State s)
     state++;
 }
 
-void Rcu::quiet()
+/*
+ * Account the CPU for batch b exactly once, whoever reports first
+ */
+void Rcu::report (unsigned cpu, mword b)
 {
-    Cpu::hazard &= ~HZD_RCU;
+    mword s;
+
+    do if (static_cast<signed long>(b - (s = ACCESS_ONCE (eqs[cpu].seen))) <= 0) return; while (!Atomic::cmp_swap (eqs[cpu].seen, s, b));
 
     if (Atomic::sub (count, 1UL) == 0)
         start_batch (RCU_CMP);
 }
 
+/*
+ * CPUs in an extended quiescent state after the start of the current batch
+ * cannot hold references from before it, report them without an IPI
+ */
+void Rcu::report_eqs()
+{
+    mword const b = l_batch;
+
+    if (b != batch() || complete (b))
+        return;
+
+    for (unsigned cpu = 0; cpu < Cpu::online; cpu++)
+        if (cpu != Cpu::id && in_eqs (cpu))
+            report (cpu, b);
+}
+
+void Rcu::quiet()
+{
+    Cpu::hazard &= ~HZD_RCU;
+
+    report (Cpu::id, l_batch);
+
+    report_eqs();
+
+    // Continue with callbacks left over from a chunked invocation
+    if (EXPECT_FALSE (!done.empty())) {
+        invoke_batch();
+
+        if (!done.empty())
+            Cpu::hazard |= HZD_RCU;
+    }
+}
+
+void Rcu::eqs_enter()
+{
+    barrier();
+
+    ACCESS_ONCE (eqs[Cpu::id].idle) = 1;
+}
+
+void Rcu::eqs_exit()
+{
+    Eqs &e = eqs[Cpu::id];
+
+    if (!ACCESS_ONCE (e.idle))
+        return;
+
+    // Clearing must be visible before any RCU-protected object is read
+    Atomic::cmp_swap (e.idle, 1UL, 0UL);
+}
+
 void Rcu::update(bool const check)
 {
     if (l_batch != batch()) {
@@ -83,6 +172,8 @@ void Rcu::update(bool const check)
         Counter::print<1,16> (l_batch, Console_vga::COLOR_LIGHT_GREEN, SPN_RCU);
     }
 
+    report_eqs();
+
     if (!curr.empty() && complete (c_batch))
         done.append (&curr);
 
@@ -97,7 +188,7 @@ void Rcu::update(bool const check)
     if (check && !curr.empty() && !next.empty() && (next.count > 2000 || curr.count > 2000))
         for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
 
-            if (!Hip::cpu_online (cpu) || Cpu::id == cpu)
+            if (!Hip::cpu_online (cpu) || Cpu::id == cpu || in_eqs (cpu))
                 continue;
 
             Lapic::send_ipi (cpu, VEC_IPI_IDL);
@@ -106,3 +197,50 @@ void Rcu::update(bool const check)
     if (!done.empty())
         invoke_batch();
 }
+
+/*
+ * Push the local callbacks through grace periods right away. Must be called
+ * in a quiescent state, i.e. at system-call entry before any kernel object
+ * is looked up. Active CPUs are kicked by an IPI to report a quiescent state
+ * on their way back to user mode; meanwhile this CPU waits in an extended
+ * quiescent state, so that concurrent expedites don't wait for each other.
+ * The caller runs with interrupts disabled, so there is a single wait of at
+ * most EXPEDITE_MS. Returns whether callbacks were invoked.
+ */
+bool Rcu::expedite()
+{
+    Counter::rcu_exp++;
+
+    if (curr.empty() && next.empty())
+        return false;
+
+    mword const pending = curr.count + next.count;
+
+    // Complete or start batches and invoke finished callbacks
+    update (false);
+
+    report (Cpu::id, l_batch);
+    report_eqs();
+
+    if (!complete (l_batch)) {
+
+        expedite_batch = l_batch;
+
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (Hip::cpu_online (cpu) && Cpu::id != cpu && !in_eqs (cpu))
+                Lapic::send_ipi (cpu, VEC_IPI_IDL);
+
+        eqs_enter();
+
+        Lapic::pause_loop_until (EXPEDITE_MS, [&] {
+            report_eqs();
+            return expedite_pending();
+        });
+
+        eqs_exit();
+    }
+
+    update (false);
+
+    return curr.count + next.count < pending;
+}
@@ -43,7 +43,7 @@ template <> mword Cpu_regs::get_g_cr3<Vmcs>()           const { return Vmcs::rea
 template <> mword Cpu_regs::get_g_cr4<Vmcs>()           const { return Vmcs::read (Vmcs::GUEST_CR4); }
 
 template <> void Cpu_regs::set_g_cr0<Vmcb> (mword v)    const { vmcb_state->vmcb.cr0 = v; }
-template <> void Cpu_regs::set_g_cr2<Vmcb> (mword v)          { vmcb_state->vmcb.cr2 = v; }
+template <> void Cpu_regs::set_g_cr2<Vmcb> (mword v)          { vmcb_state->vmcb.cr2 = v; vmcb_state->mark (Vmcb::CLEAN_CR2); }
 template <> void Cpu_regs::set_g_cr3<Vmcb> (mword v)    const { vmcb_state->vmcb.cr3 = v; }
 template <> void Cpu_regs::set_g_cr4<Vmcb> (mword v)    const { vmcb_state->vmcb.cr4 = v; }
 
@@ -60,32 +60,66 @@ template <> void Cpu_regs::set_e_bmp<Vmcs> (uint32 v)   const { Vmcs::write (Vmc
 template <> void Cpu_regs::set_s_cr0<Vmcs> (mword v)          { Vmcs::write (Vmcs::CR0_READ_SHADOW, cr0_shadow = v); }
 template <> void Cpu_regs::set_s_cr4<Vmcs> (mword v)          { Vmcs::write (Vmcs::CR4_READ_SHADOW, cr4_shadow = v); }
 
-template <> void Cpu_regs::tlb_flush<Vmcb>(bool full) const
+/* A fresh tag is taken on the next entry instead of invalidating the old one */
+template <> void Cpu_regs::tlb_flush_tag<Vmcb>(bool) const
 {
-    vtlb->flush (full);
+    vmcb_state->asid.drop();
+}
 
-    if (vmcb_state->vmcb.asid)
-        vmcb_state->vmcb.tlb_control = 1;
+template <> void Cpu_regs::tlb_flush_tag<Vmcs>(bool) const
+{
+    vmcs_state->vpid.drop();
 }
 
-template <> void Cpu_regs::tlb_flush<Vmcs>(bool full) const
+template <typename T>
+void Cpu_regs::tlb_flush (bool full)
 {
     vtlb->flush (full);
 
-    mword vpid = Vmcs::vpid();
+    if (full)
+        Vtlb_cache::flushed (this);
+
+    tlb_flush_tag<T> (full);
+}
+
+template <> void Cpu_regs::tlb_flush<Vmcs>(mword addr)
+{
+    vtlb->flush (addr, vtlb_lm);
+
+    if (!vmcs_state->vpid.valid())
+        return;
 
-    if (vpid)
-        Vpid::flush (full ? Vpid::CONTEXT_GLOBAL : Vpid::CONTEXT_NOGLOBAL, vpid);
+    if (Vmcs::has_vpid_addr())
+        Vpid::flush (Vpid::ADDRESS, vmcs_state->vpid.id, addr);
+    else
+        vmcs_state->vpid.drop();
 }
 
-template <> void Cpu_regs::tlb_flush<Vmcs>(mword addr) const
+/*
+ * Shadow side of a guest CR3 load: reuse a cached root for the new address
+ * space or fall back to flushing the active one.
+ */
+template <typename T>
+void Cpu_regs::vtlb_load (mword cr3)
 {
-    vtlb->flush (addr);
+    switch (Vtlb_cache::load (this, cr3)) {
+
+        case Vtlb_cache::FLUSH:
+            tlb_flush<T> (false);
+            break;
+
+        case Vtlb_cache::FLUSH_ALL:
+            tlb_flush<T> (true);
+            break;
 
-    mword vpid = Vmcs::vpid();
+        case Vtlb_cache::SWITCH:
+            set_g_cr3<T> (Buddy::ptr_to_phys (vtlb));
+            tlb_flush_tag<T> (false);
+            break;
 
-    if (vpid)
-        Vpid::flush (Vpid::ADDRESS, vpid, addr);
+        case Vtlb_cache::HIT:
+            break;
+    }
 }
 
 template <typename T>
@@ -213,6 +247,12 @@ void Cpu_regs::set_exc() const
 
 void Cpu_regs::svm_set_cpu_ctrl0 (mword val)
 {
+    /* intercept PAUSE while a pause filter is configured or the VMM asked for it */
+    if (ple_on || pause_vmm)
+        val |=  Vmcb::CPU_PAUSE;
+    else
+        val &= ~Vmcb::CPU_PAUSE;
+
     unsigned const msk = !!cr0_msk<Vmcb>() << 0 | !nst_on << 3 | !!cr4_msk<Vmcb>() << 4;
 
     vmcb_state->vmcb.npt_control  = nst_on;
@@ -253,10 +293,32 @@ void Cpu_regs::vmx_set_cpu_ctrl1 (mword val)
     else
         val &= ~msk;
 
+    if (ple_on)
+        val |= Vmcs::CPU_PLE;
+
+    /* page-modification logging follows the dirty log of the PD */
+    if (nst_on && vmcs_state->pml_on)
+        val |= Vmcs::CPU_PML;
+    else
+        val &= ~Vmcs::CPU_PML;
+
     val |= Vmcs::ctrl_cpu[1].set;
     val &= Vmcs::ctrl_cpu[1].clr;
 
+    /* APIC-register virtualization and virtual-interrupt delivery need the TPR shadow */
+    if (!(Vmcs::read (Vmcs::CPU_EXEC_CTRL0) & Vmcs::CPU_TPR_SHADOW))
+        val &= ~(Vmcs::CPU_APIC_REG | Vmcs::CPU_VINT);
+
     Vmcs::write (Vmcs::CPU_EXEC_CTRL1, val);
+
+    /* posted interrupts are processed whenever virtual-interrupt delivery is on */
+    if (Vmcs::has_posted()) {
+        mword pin = Vmcs::read (Vmcs::PIN_CONTROLS);
+
+        vmcs_state->apicv = val & Vmcs::CPU_VINT;
+
+        Vmcs::write (Vmcs::PIN_CONTROLS, vmcs_state->apicv ? pin | Vmcs::PIN_POSTED_INT : pin & ~Vmcs::PIN_POSTED_INT);
+    }
 }
 
 template <> void Cpu_regs::nst_ctrl<Vmcb>(bool on)
@@ -393,7 +455,7 @@ void Cpu_regs::write_cr (unsigned cr, mword val)
 
         case 3:
             if (!nst_on)
-                tlb_flush<T> (false);
+                vtlb_load<T> (val);
 
             set_cr3<T> (val);
 
@@ -438,8 +500,59 @@ void Cpu_regs::write_cr (unsigned cr, mword val)
         default:
             UNREACHED;
     }
+
+    /* the guest EFER and address space are only final on the next VM entry */
+    if (!nst_on && cr != 2 && (Hip::feature() & Hip::FEAT_VMX))
+        pdpte_ld = true;
 }
 
+template <> void Cpu_regs::load_pdpte<Vmcb>() { }
+
+/*
+ * Legacy PAE paging loads the PDPTEs on every CR3 write and paging-mode
+ * change. Without EPT nothing else fills the guest PDPTE fields, so keep them
+ * current for the vTLB walker and the UTCB.
+ */
+template <> void Cpu_regs::load_pdpte<Vmcs>()
+{
+    pdpte_ld = false;
+
+#ifdef __x86_64__
+    if (!(cr0_shadow & Cpu::CR0_PG) || !(cr4_shadow & Cpu::CR4_PAE) || get_g_efer<Vmcs>() & Cpu::EFER_LMA)
+        return;
+
+    uint64 *p = reinterpret_cast<uint64 *>(cr3_shadow & ~0x1fUL);
+
+    for (unsigned i = 0; i < 4; i++) {
+
+        uint64 e;
+        if (User::peek (p + i, e) != ~0UL)
+            e = 0;
+
+        Vmcs::write (Vmcs::Encoding (Vmcs::GUEST_PDPTE0 + i * 2), e);
+    }
+
+    vmcs_state->guest.invalidate();
+#endif
+}
+
+mword Cpu_regs::guest_efer() const
+{
+    return Hip::feature() & Hip::FEAT_VMX ? get_g_efer<Vmcs>() : get_g_efer<Vmcb>();
+}
+
+#ifdef __x86_64__
+uint64 Cpu_regs::guest_pdpte (unsigned i) const
+{
+    if (Hip::feature() & Hip::FEAT_VMX)
+        return Vmcs::read (Vmcs::Encoding (Vmcs::GUEST_PDPTE0 + i * 2));
+
+    /* SVM has no PDPTE fields, the entries come straight from memory */
+    uint64 e;
+    return User::peek (reinterpret_cast<uint64 *>(cr3_shadow & ~0x1fUL) + i, e) == ~0UL ? e : 0;
+}
+#endif
+
 template <> void Cpu_regs::write_efer<Vmcb> (mword val)
 {
     vmcb_state->vmcb.efer = val;
@@ -455,6 +568,8 @@ template <> void Cpu_regs::write_efer<Vmcs> (mword val)
         Vmcs::write (Vmcs::ENT_CONTROLS, Vmcs::read (Vmcs::ENT_CONTROLS) & ~Vmcs::ENT_GUEST_64);
 }
 
+template void Cpu_regs::tlb_flush<Vmcb> (bool);
+template void Cpu_regs::tlb_flush<Vmcs> (bool);
 template mword Cpu_regs::linear_address<Vmcb> (mword) const;
 template mword Cpu_regs::linear_address<Vmcs> (mword) const;
 template mword Cpu_regs::read_cr<Vmcb> (unsigned) const;
@@ -25,6 +25,7 @@
 #include "stdio.hpp"
 #include "timeout_budget.hpp"
 #include "vectors.hpp"
+#include "vmx.hpp"
 
 INIT_PRIORITY (PRIO_LOCAL)
 Sc::Rq Sc::rq;
@@ -145,6 +146,7 @@ void Sc::schedule (bool suspend, bool use_left)
         Sc *sc = list[prio_top];
         assert (sc);
 
+        Timeout_budget::guest[Cpu::id] = Vmcs::has_preempt() && sc->ec->vcpu();
         Timeout_budget::budget.enqueue (t + sc->left);
 
         ctr_loop = 0;
@@ -156,6 +158,42 @@ void Sc::schedule (bool suspend, bool use_left)
     current->ec->activate();
 }
 
+/*
+ * Move the first vCPU of the given PD that is ready at the priority of the
+ * current SC to the head of its list, so it runs once the current SC yields.
+ * All other SCs keep their order.
+ */
+bool Sc::boost (Pd const *pd)
+{
+    Sc *head = list[current->prio];
+
+    if (!head)
+        return false;
+
+    for (Sc *sc = head;; sc = sc->next) {
+
+        if (sc->ec->pd == pd && sc->ec->vcpu()) {
+
+            if (sc != head) {
+                sc->prev->next = sc->next;
+                sc->next->prev = sc->prev;
+
+                sc->next = head;
+                sc->prev = head->prev;
+                head->prev->next = sc;
+                head->prev = sc;
+
+                list[current->prio] = sc;
+            }
+
+            return true;
+        }
+
+        if (sc->next == head)
+            return false;
+    }
+}
+
 void Sc::remote_enqueue(bool inc_ref)
 {
     if (Cpu::id == cpu)
@@ -19,11 +19,16 @@
  */
 
 #include "assert.hpp"
+#include "atomic.hpp"
+#include "barrier.hpp"
 #include "bits.hpp"
+#include "cmdline.hpp"
 #include "lock_guard.hpp"
 #include "slab.hpp"
 #include "stdio.hpp"
+#include "string.hpp"
 #include "pd.hpp"
+#include "x86.hpp"
 
 Slab::Slab (Slab_cache *slab_cache)
     : avail (slab_cache->elem),
@@ -62,13 +67,25 @@ void Slab::free (void *ptr)
     head = link;
 }
 
-Slab_cache::Slab_cache (unsigned long elem_size, unsigned elem_align)
-          : curr (nullptr),
-            head (nullptr),
-            size (align_up (elem_size, sizeof (mword))),
-            buff (align_up (size + sizeof (mword), elem_align)),
-            elem ((PAGE_SIZE - sizeof (Slab)) / buff)
+INIT_PRIORITY (PRIO_BUDDY)
+Quota Slab_cache::shared;
+
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Slab_cache::dirs (NUM_CPU * sizeof (Magazine *), sizeof (mword), nullptr, false);
+INIT_PRIORITY (PRIO_SLAB) Slab_cache Slab_cache::mags (sizeof (Magazine), 64, nullptr, false);
+
+Slab_cache::Slab_cache (unsigned long elem_size, unsigned elem_align, Slab_cache *a, bool c)
+          : curr   (nullptr),
+            head   (nullptr),
+            dir    (nullptr),
+            cached (c),
+            slabs  (0),
+            size   (align_up (elem_size, sizeof (mword))),
+            buff   (align_up (size + sizeof (mword), elem_align)),
+            elem   ((PAGE_SIZE - sizeof (Slab)) / buff),
+            arena  (a)
 {
+    assert (!arena || arena->buff == buff);
+
     trace (TRACE_MEMORY, "Slab Cache:%p (S:%lu A:%u)",
            this,
            elem_size,
@@ -79,6 +96,8 @@ void Slab_cache::grow(Quota &quota)
 {
     Slab *slab = new (quota) Slab (this);
 
+    slabs++;
+
     if (head)
         head->prev = slab;
 
@@ -86,10 +105,8 @@ void Slab_cache::grow(Quota &quota)
     head = curr = slab;
 }
 
-void *Slab_cache::alloc(Quota &quota)
+void *Slab_cache::alloc_slab (Quota &quota)
 {
-    Lock_guard <Spinlock> guard (lock);
-
     if (EXPECT_FALSE (!curr))
         grow(quota);
 
@@ -105,10 +122,8 @@ void *Slab_cache::alloc(Quota &quota)
     return ret;
 }
 
-void Slab_cache::free (void *ptr, Quota &quota)
+void Slab_cache::free_slab (void *ptr, Quota &quota)
 {
-    Lock_guard <Spinlock> guard (lock);
-
     Slab *slab = reinterpret_cast<Slab *>(reinterpret_cast<mword>(ptr) & ~PAGE_MASK);
 
     assert (slab->cache == this);
@@ -173,8 +188,158 @@ void Slab_cache::free (void *ptr, Quota &quota)
     }
 }
 
+void *Slab_cache::refill (Magazine &m, Quota &quota)
+{
+    Lock_guard <Spinlock> guard (lock);
+
+    void *ret = alloc_slab (quota);
+
+    // Fill the magazine from partial slabs only, don't grow for it
+    while (curr && m.count < Magazine::BATCH)
+        m.obj[m.count++] = alloc_slab (quota);
+
+    return ret;
+}
+
+void Slab_cache::flush (Magazine &m, mword n, Quota &quota)
+{
+    Lock_guard <Spinlock> guard (lock);
+
+    while (n-- && m.count)
+        free_slab (m.obj[--m.count], quota);
+}
+
+Quota &Slab_cache::mag_quota (Quota &quota)
+{
+    return arena ? quota : Pd::kern.quota;
+}
+
+Slab_cache::Magazine *Slab_cache::magazine (Quota &quota)
+{
+    if (EXPECT_FALSE (!cached))
+        return nullptr;
+
+    Magazine **d = ACCESS_ONCE (dir);
+
+    if (EXPECT_FALSE (!d)) {
+        d = static_cast<Magazine **>(dirs.alloc (mag_quota (quota)));
+
+        memset (d, 0, NUM_CPU * sizeof *d);
+
+        // Another CPU installed a directory first
+        if (!Atomic::cmp_swap (dir, static_cast<Magazine **>(nullptr), d)) {
+            dirs.free (d, mag_quota (quota));
+            d = ACCESS_ONCE (dir);
+        }
+    }
+
+    Magazine *&m = d[Cpu::id];
+
+    if (EXPECT_FALSE (!m)) {
+        Magazine *n = static_cast<Magazine *>(mags.alloc (mag_quota (quota)));
+        n->count = 0;
+        m = n;
+    }
+
+    return m;
+}
+
+/*
+ * Return the objects cached on all CPUs. Only done once the cache has no
+ * users left, so the magazines of remote CPUs are not touched concurrently.
+ */
+void Slab_cache::drain (Quota &quota)
+{
+    if (!dir)
+        return;
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+        if (!dir[cpu])
+            continue;
+
+        flush (*dir[cpu], Magazine::DEPTH, quota);
+        mags.free (dir[cpu], mag_quota (quota));
+    }
+
+    dirs.free (dir, mag_quota (quota));
+    dir = nullptr;
+}
+
+bool Slab_cache::owns (void *ptr) const
+{
+    Slab *slab = reinterpret_cast<Slab *>(reinterpret_cast<mword>(ptr) & ~PAGE_MASK);
+
+    return slab->cache == this || (arena && slab->cache == arena);
+}
+
+void *Slab_cache::alloc(Quota &quota)
+{
+    /*
+     * Arena objects are charged to the requesting PD, arena pages to the
+     * kernel. A PD at its limit does not grow the arena, it uses its own
+     * slabs, which are charged in full pages.
+     */
+    if (arena && Cmdline::arena && !quota.hit_limit()) {
+        quota.alloc_obj (buff);
+        return arena->alloc (shared);
+    }
+
+    bool pre = Cpu::preempt_status();
+    if (pre)
+        Cpu::preempt_disable();
+
+    void *ret;
+
+    Magazine *m = magazine (quota);
+
+    if (EXPECT_FALSE (!m)) {
+        Lock_guard <Spinlock> guard (lock);
+        ret = alloc_slab (quota);
+    } else
+        ret = EXPECT_TRUE (m->count) ? m->obj[--m->count] : refill (*m, quota);
+
+    if (pre)
+        Cpu::preempt_enable();
+
+    return ret;
+}
+
+void Slab_cache::free (void *ptr, Quota &quota)
+{
+    Slab *slab = reinterpret_cast<Slab *>(reinterpret_cast<mword>(ptr) & ~PAGE_MASK);
+
+    // Objects allocated while the arena was enabled go back to the arena
+    if (slab->cache != this) {
+        assert (arena && slab->cache == arena);
+        quota.free_obj (buff);
+        arena->free (ptr, shared);
+        return;
+    }
+
+    bool pre = Cpu::preempt_status();
+    if (pre)
+        Cpu::preempt_disable();
+
+    Magazine *m = magazine (quota);
+
+    if (EXPECT_FALSE (!m)) {
+        Lock_guard <Spinlock> guard (lock);
+        free_slab (ptr, quota);
+    } else {
+        if (EXPECT_FALSE (m->count == Magazine::DEPTH))
+            flush (*m, Magazine::BATCH, quota);
+
+        m->obj[m->count++] = ptr;
+    }
+
+    if (pre)
+        Cpu::preempt_enable();
+}
+
 void Slab_cache::free (Quota &quota)
 {
+    drain (quota);
+
     while (head) {
         assert (!head->full());
         assert (head->cache == this);
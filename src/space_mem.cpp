@@ -31,7 +31,6 @@
 
 Bit_alloc<4096, Space_mem::NO_PCID> Space_mem::did_alloc;
 Bit_alloc<1<<16, Space_mem::NO_DOMAIN_ID> Space_mem::dom_alloc;
-Bit_alloc<1<<15, Space_mem::NO_ASID_ID>   Space_mem::asid_alloc;
 
 void Space_mem::init (Quota &quota, unsigned cpu)
 {
@@ -56,6 +55,8 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
     bool f = false;
 
     if (s & 1 && Dpt::active()) {
+        bool d = false;
+
         mword ord = min (o, Dpt::ord);
         for (unsigned long i = 0; i < 1UL << (o - ord); i++) {
             if (!r && !dpt.check(quota, ord)) {
@@ -63,14 +64,22 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
                 return false;
             }
 
-            f |= dpt.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), a, r ? Dpt::TYPE_DN : Dpt::TYPE_UP);
+            d |= dpt.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), a, r ? Dpt::TYPE_DN : Dpt::TYPE_UP);
         }
 
         if (Dpt::force_flush)
-            f = true;
+            d = true;
+
+        /* any downgrade leaves stale IOTLB entries, not just freed tables */
+        if (r || d)
+            dma_stale.add (mdb->node_base, o);
+
+        f |= d;
     }
 
     if (s & 1 && Ipt::active()) {
+        bool d = false;
+
         mword ord = min (o, Ipt::ord);
         for (unsigned long i = 0; i < 1UL << (o - ord); i++) {
             if (!r && !ipt.check(quota, ord)) {
@@ -78,8 +87,13 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
                 return false;
             }
 
-            f |= ipt.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), Ipt::hw_attr(a), r ? Ipt::TYPE_DN : Ipt::TYPE_UP);
+            d |= ipt.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), Ipt::hw_attr(a), r ? Ipt::TYPE_DN : Ipt::TYPE_UP);
         }
+
+        if (r || d)
+            dma_stale.add (mdb->node_base, o);
+
+        f |= d;
     }
 
     if (s & 2) {
@@ -190,6 +204,36 @@ void Space_mem::shootdown(Pd * local)
     }
 }
 
+/*
+ * Harvest the dirty bits of n guest pages from gpa into bitmap b. With a
+ * dirty log, regions no vCPU logged a write to are skipped, and a region is
+ * retired from the log only if it is scanned as a whole.
+ */
+unsigned long Space_mem::collect_dirty (uint64 gpa, unsigned long n, mword *b)
+{
+    if (Vmcb::has_npt())
+        return npt.collect (Hpt::HPT_D, static_cast<mword>(gpa), n, b);
+
+    if (!dirty)
+        return ept.collect (Ept::EPT_D, gpa, n, b);
+
+    unsigned long const r = 1UL << (Dirty_log::REGION_BITS - PAGE_BITS);
+    unsigned long count = 0;
+
+    for (unsigned long i = 0, s; i < n; i += s) {
+
+        uint64 a = gpa + (static_cast<uint64>(i) << PAGE_BITS);
+        unsigned long o = static_cast<unsigned long>(a >> PAGE_BITS) & (r - 1);
+
+        s = min (r - o, n - i);
+
+        if (o || s != r ? dirty->test (a) : dirty->test_clear (a))
+            count += ept.collect (Ept::EPT_D, a, s, b, i);
+    }
+
+    return count;
+}
+
 void Space_mem::insert_root (Quota &quota, Slab_cache &cache, uint64 s, uint64 e, mword a)
 {
     for (uint64 p = s; p < e; s = p) {
@@ -70,7 +70,6 @@ struct Msr_bitmap
 };
 
 Paddr       Vmcb::root;
-unsigned    Vmcb::asid_ctr;
 uint32      Vmcb::svm_version;
 uint32      Vmcb::svm_feature;
 
@@ -79,7 +78,7 @@ Queue<Vmcb_state> Vmcb_state::queue;
 INIT_PRIORITY (PRIO_SLAB)
 Slab_cache Vmcb_state::cache (sizeof (Vmcb_state), 8);
 
-Vmcb::Vmcb (Quota &quota, mword bmp, mword nptp, unsigned id) : base_io (bmp), asid (id), int_control (1ul << 24), npt_cr3 (nptp), efer (Cpu::EFER_SVME), g_pat (0x7040600070406ull)
+Vmcb::Vmcb (Quota &quota, mword bmp, mword nptp) : base_io (bmp), int_control (1ul << 24), npt_cr3 (nptp), efer (Cpu::EFER_SVME), g_pat (0x7040600070406ull)
 {
     auto &msr_bitmap = *new (quota) Msr_bitmap;
 
@@ -112,7 +111,7 @@ void Vmcb::init()
 
     Msr::write (Msr::IA32_EFER, Msr::read<uint32>(Msr::IA32_EFER) | Cpu::EFER_SVME);
     if (!root)
-        root = Buddy::ptr_to_phys (new (Pd::kern.quota) Vmcb(Space_mem::NO_ASID_ID));
+        root = Buddy::ptr_to_phys (new (Pd::kern.quota) Vmcb(0));
     Msr::write (Msr::AMD_SVM_HSAVE_PA, root);
 
     trace (TRACE_SVM, "VMCB:%#010lx REV:%#x NPT:%d", root, svm_version, has_npt());
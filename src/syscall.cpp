@@ -28,11 +28,15 @@
 #include "pci.hpp"
 #include "pt.hpp"
 #include "sm.hpp"
+#include "svm.hpp"
 #include "stdio.hpp"
 #include "syscall.hpp"
 #include "utcb.hpp"
 #include "vectors.hpp"
+#include "vm_policy.hpp"
+#include "vmx.hpp"
 #include "acpi.hpp"
+#include "rcu.hpp"
 #include "ioapic.hpp"
 
 template <Sys_regs::Status S, bool T>
@@ -82,7 +86,8 @@ void Ec::delegate()
                          user ? dst->utcb->del : Crd (Crd::MEM, (dst->cont == ret_user_iret ? dst->regs.cr2 : dst->regs.nst_fault) >> PAGE_BITS),
                          src->utcb->xfer(),
                          user ? dst->utcb->xfer() : nullptr,
-                         src->utcb->ti());
+                         src->utcb->ti(),
+                         user || dst->cont == ret_user_iret ? 0 : dst->fault_ord);
 
     if (Cpu::hazard & HZD_OOM) {
         if (dst->pd->quota.hit_limit())
@@ -360,6 +365,12 @@ void Ec::sys_reply()
 template <void(*C)()>
 void Ec::check(mword r, bool call)
 {
+    /* freed objects may still wait for a grace period, try to reclaim them first */
+    if (Pd::current->quota.hit_limit(r) && Rcu::expedite() && !Pd::current->quota.hit_limit(r)) {
+        Counter::rcu_exp_oom++;
+        return;
+    }
+
     if (Pd::current->quota.hit_limit(r)) {
         trace(TRACE_OOM, "%s:%u - not enough resources %lu/%lu (%lu)", __func__, __LINE__, Pd::current->quota.usage(), Pd::current->quota.limit(), r);
 
@@ -645,22 +656,39 @@ void Ec::sys_revoke()
     } else
         pd = reinterpret_cast<Pd *>(r->pd());
 
-    pd->rev_crd (r->crd(), r->self(), true, r->keep());
+    Pd *dma = nullptr;
+
+    /* only a revoke with a semaphore to signal may leave its flush pending */
+    pd->rev_crd (r->crd(), r->self(), true, r->keep(), r->sm() ? &dma : nullptr);
 
     current->cont = sys_finish<Sys_regs::SUCCESS>;
     r->rem(nullptr);
 
-    if (r->remote() && pd->del_rcu())
-        Rcu::call(pd);
+    bool signal = false;
 
     if (EXPECT_FALSE (r->sm())) {
         Capability cap_sm = Space_obj::lookup (r->sm());
         if (EXPECT_FALSE (cap_sm.obj()->type() == Kobject::SM && (cap_sm.prm() & 1))) {
             Sm *sm = static_cast<Sm *>(cap_sm.obj());
-            sm->add_to_rcu();
+            if (!dma || !dma->defer_sm (sm))
+                sm->add_to_rcu();
+
+            signal = true;
         }
     }
 
+    if (dma) {
+        /* no semaphore to hold back, so the flush must not stay pending */
+        if (!signal)
+            dma->flush_pgt();
+
+        if (dma->del_rcu())
+            Rcu::call (dma);
+    }
+
+    if (r->remote() && pd->del_rcu())
+        Rcu::call(pd);
+
     sys_finish<Sys_regs::SUCCESS>();
 }
 
@@ -963,6 +991,182 @@ void Ec::sys_ec_ctrl()
             break;
         }
 
+        case 9: /* configure vCPU exit policy */
+        case 10: /* read absorbed exits */
+        {
+            Capability cap = Space_obj::lookup (r->ec());
+            if (EXPECT_FALSE (cap.obj()->type() != Kobject::EC || !(cap.prm() & 1UL << 0))) {
+                trace (TRACE_ERROR, "%s: Bad EC CAP (%#lx)", __func__, r->ec());
+                sys_finish<Sys_regs::BAD_CAP>();
+            }
+
+            Ec *ec = static_cast<Ec *>(cap.obj());
+
+            if (EXPECT_FALSE (!ec->vcpu() || !current->utcb))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            if (EXPECT_FALSE (current->cpu != ec->cpu)) {
+                trace (TRACE_ERROR, "%s: Called from remote CPU", __func__);
+                sys_finish<Sys_regs::BAD_CPU>();
+            }
+
+            if (r->op() == 10) {
+                Vm_policy const *p = ec->policy;
+                r->set_absorbed (p ? static_cast<mword>(p->count (Vm_policy::CPUID)) : 0,
+                                 p ? static_cast<mword>(p->count (Vm_policy::RDTSC)) : 0,
+                                 p ? static_cast<mword>(p->count (Vm_policy::RDMSR)) : 0);
+                break;
+            }
+
+            if (!ec->policy) {
+                if (ec->pd->quota.hit_limit(1))
+                    sys_finish<Sys_regs::QUO_OOM>();
+
+                ec->policy = new (ec->pd->quota) Vm_policy;
+            }
+
+            if (!ec->policy->configure (r->policy(), *current->utcb))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            break;
+        }
+
+        case 11: /* post interrupt vector to vCPU */
+        {
+            Capability cap = Space_obj::lookup (r->ec());
+            if (EXPECT_FALSE (cap.obj()->type() != Kobject::EC || !(cap.prm() & 1UL << 0))) {
+                trace (TRACE_ERROR, "%s: Bad EC CAP (%#lx)", __func__, r->ec());
+                sys_finish<Sys_regs::BAD_CAP>();
+            }
+
+            Ec *ec = static_cast<Ec *>(cap.obj());
+
+            if (EXPECT_FALSE (!ec->vcpu()))
+                sys_finish<Sys_regs::BAD_CAP>();
+
+            if (EXPECT_FALSE (r->vector() < 16 || r->vector() > 255))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            if (EXPECT_FALSE (!(Hip::feature() & Hip::FEAT_VMX) || !ec->regs.vmcs_state->apicv))
+                sys_finish<Sys_regs::BAD_FTR>();
+
+            /* a changed EOI-exit bitmap needs a VM exit to get loaded */
+            bool const eoi = ec->regs.vmcs_state->eoi_exit (static_cast<unsigned>(r->vector()), r->level());
+            bool const pin = ec->regs.vmcs_state->pi->post (static_cast<unsigned>(r->vector()));
+
+            if ((eoi || pin) && ec->cpu != Cpu::id && Ec::remote (ec->cpu) == ec)
+                Lapic::send_ipi (ec->cpu, eoi ? VEC_IPI_RKE : VEC_IPI_PIN);
+
+            break;
+        }
+
+        case 12: /* configure pause-loop exiting */
+        case 13: /* read pause-loop exits and yields */
+        {
+            Capability cap = Space_obj::lookup (r->ec());
+            if (EXPECT_FALSE (cap.obj()->type() != Kobject::EC || !(cap.prm() & 1UL << 0))) {
+                trace (TRACE_ERROR, "%s: Bad EC CAP (%#lx)", __func__, r->ec());
+                sys_finish<Sys_regs::BAD_CAP>();
+            }
+
+            Ec *ec = static_cast<Ec *>(cap.obj());
+
+            if (EXPECT_FALSE (!ec->vcpu()))
+                sys_finish<Sys_regs::BAD_CAP>();
+
+            if (r->op() == 13) {
+                r->set_pause (static_cast<mword>(ec->pause_exits), static_cast<mword>(ec->pause_yields));
+                break;
+            }
+
+            if (EXPECT_FALSE (current->cpu != ec->cpu)) {
+                trace (TRACE_ERROR, "%s: Called from remote CPU", __func__);
+                sys_finish<Sys_regs::BAD_CPU>();
+            }
+
+            bool const vmx = Hip::feature() & Hip::FEAT_VMX;
+
+            if (EXPECT_FALSE (vmx ? !Vmcs::has_ple() : !Vmcb::has_pause_filter()))
+                sys_finish<Sys_regs::BAD_FTR>();
+
+            ec->regs.ple_on = r->ple_window() != 0;
+
+            if (vmx) {
+                ec->regs.vmcs_state->make_current();
+
+                Vmcs::write (Vmcs::PLE_GAP,    r->ple_gap());
+                Vmcs::write (Vmcs::PLE_WINDOW, r->ple_window());
+
+                ec->regs.vmx_set_cpu_ctrl1 (Vmcs::read (Vmcs::CPU_EXEC_CTRL1) & ~Vmcs::CPU_PLE);
+            } else {
+                Vmcb &vmcb = ec->regs.vmcb_state->vmcb;
+
+                vmcb.pause_count     = static_cast<uint16>(r->ple_window());
+                vmcb.pause_threshold = Vmcb::has_pause_threshold() ? static_cast<uint16>(r->ple_gap()) : 0;
+
+                ec->regs.svm_set_cpu_ctrl0 (vmcb.intercept_cpu[0]);
+            }
+
+            break;
+        }
+
+        case 14: /* configure nested-page fault-around window */
+        {
+            Capability cap = Space_obj::lookup (r->ec());
+            if (EXPECT_FALSE (cap.obj()->type() != Kobject::EC || !(cap.prm() & 1UL << 0))) {
+                trace (TRACE_ERROR, "%s: Bad EC CAP (%#lx)", __func__, r->ec());
+                sys_finish<Sys_regs::BAD_CAP>();
+            }
+
+            Ec *ec = static_cast<Ec *>(cap.obj());
+
+            if (EXPECT_FALSE (!ec->vcpu()))
+                sys_finish<Sys_regs::BAD_CAP>();
+
+            /* at most one leaf table worth of neighbours */
+            if (EXPECT_FALSE (r->fault_ord() > Ept::bpl()))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            ec->fault_ord = r->fault_ord();
+
+            break;
+        }
+
+        case 15: /* read exit profile */
+        {
+            Capability cap = Space_obj::lookup (r->ec());
+            if (EXPECT_FALSE (cap.obj()->type() != Kobject::EC || !(cap.prm() & 1UL << 0))) {
+                trace (TRACE_ERROR, "%s: Bad EC CAP (%#lx)", __func__, r->ec());
+                sys_finish<Sys_regs::BAD_CAP>();
+            }
+
+            Ec *ec = static_cast<Ec *>(cap.obj());
+
+            if (EXPECT_FALSE (!ec->vcpu() || !current->utcb || r->first() >= NUM_VMI))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            if (EXPECT_FALSE (current->cpu != ec->cpu)) {
+                trace (TRACE_ERROR, "%s: Called from remote CPU", __func__);
+                sys_finish<Sys_regs::BAD_CPU>();
+            }
+
+            /* the first request starts profiling and returns an empty histogram */
+            if (!ec->profile) {
+                if (ec->pd->quota.hit_limit(1))
+                    sys_finish<Sys_regs::QUO_OOM>();
+
+                ec->profile = new (ec->pd->quota) Vm_profile;
+            }
+
+            mword n = NUM_VMI - r->first();
+            Vm_profile::Entry *e = current->utcb->put_items<Vm_profile::Entry> (n);
+
+            for (mword i = 0; i < n; i++)
+                e[i] = ec->profile->get (r->first() + i);
+
+            break;
+        }
+
         default:
             sys_finish<Sys_regs::BAD_PAR>();
     }
@@ -1097,7 +1301,59 @@ void Ec::sys_pd_ctrl()
     Pd *src = static_cast<Pd *>(cap.obj());
 
     if (r->dbg()) {
-        r->dump(src->quota.limit(), src->quota.usage());
+        r->dump(src->quota.limit(), src->quota.usage(), src->slab_pages());
+        sys_finish<Sys_regs::SUCCESS>();
+    }
+
+    if (r->lazy()) {
+        /* only the PD that created src may trade IOMMU strictness for speed */
+        if (EXPECT_FALSE (r->lazy_on() && src->space != static_cast<Space_obj *>(Pd::current))) {
+            trace (TRACE_ERROR, "%s: PD %p not owned by caller", __func__, src);
+            sys_finish<Sys_regs::BAD_CAP>();
+        }
+
+        src->lazy_dma (r->lazy_on());
+        sys_finish<Sys_regs::SUCCESS>();
+    }
+
+    if (r->dirty()) {
+        if (EXPECT_FALSE (!current->utcb || r->pages() > Utcb::bitmap_bits()))
+            sys_finish<Sys_regs::BAD_PAR>();
+
+        if (EXPECT_FALSE (!Vmcb::has_npt() && !Vmcs::has_ept_ad()))
+            sys_finish<Sys_regs::BAD_FTR>();
+
+        if (!r->pages()) {
+            src->logging = false;
+            sys_finish<Sys_regs::SUCCESS>();
+        }
+
+        if (Vmcs::has_pml() && !src->dirty) {
+            if (src->quota.hit_limit(1))
+                sys_finish<Sys_regs::QUO_OOM>();
+
+            Dirty_log *log = new (src->quota) Dirty_log;
+            if (!Atomic::cmp_swap (src->dirty, static_cast<Dirty_log *>(nullptr), log))
+                Dirty_log::destroy (log, src->quota);
+        }
+
+        /* writes went unlogged while logging was off */
+        if (!src->logging) {
+            if (src->dirty)
+                src->dirty->mark_all();
+            src->logging = true;
+        }
+
+        /* kick vCPUs out of guest mode, which drains their PML buffers */
+        src->gtlb.merge (src->cpus);
+        Space_mem::shootdown (src);
+
+        r->set_dirty (src->collect_dirty (r->gpa(), r->pages(), current->utcb->bitmap (r->pages())));
+
+        /* TLBs may still hold the dirty bits cleared above */
+        src->gtlb.merge (src->cpus);
+        Space_mem::shootdown (src);
+
         sys_finish<Sys_regs::SUCCESS>();
     }
 
@@ -41,7 +41,7 @@ void Timeout::enqueue (uint64 t)
     if (!p) {
         next = list;
         list = this;
-        Lapic::set_timer (time);
+        arm();
     } else {
         next = p->next;
         p->next = this;
@@ -62,7 +62,7 @@ uint64 Timeout::dequeue()
             prev->next = next;
 
         else if ((list = next))
-            Lapic::set_timer (list->time);
+            arm();
     }
 
     prev = next = nullptr;
@@ -86,12 +86,33 @@ void Timeout::check()
          * sleep states (non-invariant TSC). In that case, we program the
          * LAPIC again for the next timeout.
          */
-         Lapic::set_timer(list->time);
+         arm();
     }
 }
 
 void Timeout::sync()
 {
     if (list)
-         Lapic::set_timer(list->time);
+         arm();
+}
+
+/*
+ * Program the LAPIC timer for the first timeout. A timeout enforced by
+ * other means keeps the LAPIC armed as a backstop, late by its slack.
+ */
+void Timeout::arm()
+{
+    Timeout *t = list;
+
+    if (!t) {
+        Lapic::clr_timer();
+        return;
+    }
+
+    uint64 d = t->time + t->slack();
+
+    if (t->next && t->next->time < d)
+        d = t->next->time;
+
+    Lapic::set_timer (d);
 }
@@ -18,12 +18,20 @@
 #include "cpu.hpp"
 #include "hazards.hpp"
 #include "initprio.hpp"
+#include "lapic.hpp"
 #include "timeout_budget.hpp"
 
 INIT_PRIORITY (PRIO_LOCAL)
 Timeout_budget Timeout_budget::budget;
 
+bool Timeout_budget::guest[NUM_CPU];
+
 void Timeout_budget::trigger()
 {
     Cpu::hazard |= HZD_SCHED;
 }
+
+uint64 Timeout_budget::slack() const
+{
+    return guest[Cpu::id] ? Lapic::freq_tsc / 1000 * BACKSTOP_US : 0;
+}
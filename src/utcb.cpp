@@ -118,6 +118,14 @@ bool Utcb::save_exc (Cpu_regs *regs)
     return mtd & Mtd::FPU;
 }
 
+static void write_vmx_seg (Utcb_segment const &s, Vmcs::Encoding sel, Vmcs::Encoding base, Vmcs::Encoding limit, Vmcs::Encoding ar)
+{
+    Vmcs::write (sel,   s.sel);
+    Vmcs::write (base,  static_cast<mword>(s.base));
+    Vmcs::write (limit, s.limit);
+    Vmcs::write (ar,   (s.ar << 4 & 0x1f000) | (s.ar & 0xff));
+}
+
 bool Utcb::load_vmx (Cpu_regs *regs)
 {
     mword m = regs->mtd;
@@ -150,43 +158,77 @@ bool Utcb::load_vmx (Cpu_regs *regs)
 
     regs->vmcs_state->make_current();
 
-    if (m & Mtd::RSP)
-        rsp = Vmcs::read (Vmcs::GUEST_RSP);
+    Vmcs_cache &c = regs->vmcs_state->guest;
+
+    if (m & Mtd::RSP) {
+        if (!c.cached (Mtd::RSP))
+            c.rsp = Vmcs::read (Vmcs::GUEST_RSP);
+        rsp = c.rsp;
+    }
 
     if (m & Mtd::RIP_LEN) {
-        rip      = Vmcs::read (Vmcs::GUEST_RIP);
+        if (!c.cached (Mtd::RIP_LEN))
+            c.rip = Vmcs::read (Vmcs::GUEST_RIP);
+        rip      = c.rip;
         inst_len = Vmcs::read (Vmcs::EXI_INST_LEN);
     }
 
-    if (m & Mtd::RFLAGS)
-        rflags = Vmcs::read (Vmcs::GUEST_RFLAGS);
+    if (m & Mtd::RFLAGS) {
+        if (!c.cached (Mtd::RFLAGS))
+            c.rflags = Vmcs::read (Vmcs::GUEST_RFLAGS);
+        rflags = c.rflags;
+    }
 
     if (m & Mtd::DS_ES) {
-        ds.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_DS), Vmcs::read (Vmcs::GUEST_BASE_DS), Vmcs::read (Vmcs::GUEST_LIMIT_DS), Vmcs::read (Vmcs::GUEST_AR_DS));
-        es.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_ES), Vmcs::read (Vmcs::GUEST_BASE_ES), Vmcs::read (Vmcs::GUEST_LIMIT_ES), Vmcs::read (Vmcs::GUEST_AR_ES));
+        if (!c.cached (Mtd::DS_ES)) {
+            c.ds.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_DS), Vmcs::read (Vmcs::GUEST_BASE_DS), Vmcs::read (Vmcs::GUEST_LIMIT_DS), Vmcs::read (Vmcs::GUEST_AR_DS));
+            c.es.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_ES), Vmcs::read (Vmcs::GUEST_BASE_ES), Vmcs::read (Vmcs::GUEST_LIMIT_ES), Vmcs::read (Vmcs::GUEST_AR_ES));
+        }
+        ds = c.ds;
+        es = c.es;
     }
 
     if (m & Mtd::FS_GS) {
-        fs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_FS), Vmcs::read (Vmcs::GUEST_BASE_FS), Vmcs::read (Vmcs::GUEST_LIMIT_FS), Vmcs::read (Vmcs::GUEST_AR_FS));
-        gs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_GS), Vmcs::read (Vmcs::GUEST_BASE_GS), Vmcs::read (Vmcs::GUEST_LIMIT_GS), Vmcs::read (Vmcs::GUEST_AR_GS));
+        if (!c.cached (Mtd::FS_GS)) {
+            c.fs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_FS), Vmcs::read (Vmcs::GUEST_BASE_FS), Vmcs::read (Vmcs::GUEST_LIMIT_FS), Vmcs::read (Vmcs::GUEST_AR_FS));
+            c.gs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_GS), Vmcs::read (Vmcs::GUEST_BASE_GS), Vmcs::read (Vmcs::GUEST_LIMIT_GS), Vmcs::read (Vmcs::GUEST_AR_GS));
+        }
+        fs = c.fs;
+        gs = c.gs;
     }
 
     if (m & Mtd::CS_SS) {
-        cs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_CS), Vmcs::read (Vmcs::GUEST_BASE_CS), Vmcs::read (Vmcs::GUEST_LIMIT_CS), Vmcs::read (Vmcs::GUEST_AR_CS));
-        ss.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_SS), Vmcs::read (Vmcs::GUEST_BASE_SS), Vmcs::read (Vmcs::GUEST_LIMIT_SS), Vmcs::read (Vmcs::GUEST_AR_SS));
+        if (!c.cached (Mtd::CS_SS)) {
+            c.cs.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_CS), Vmcs::read (Vmcs::GUEST_BASE_CS), Vmcs::read (Vmcs::GUEST_LIMIT_CS), Vmcs::read (Vmcs::GUEST_AR_CS));
+            c.ss.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_SS), Vmcs::read (Vmcs::GUEST_BASE_SS), Vmcs::read (Vmcs::GUEST_LIMIT_SS), Vmcs::read (Vmcs::GUEST_AR_SS));
+        }
+        cs = c.cs;
+        ss = c.ss;
     }
 
-    if (m & Mtd::TR)
-        tr.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_TR), Vmcs::read (Vmcs::GUEST_BASE_TR), Vmcs::read (Vmcs::GUEST_LIMIT_TR), Vmcs::read (Vmcs::GUEST_AR_TR));
+    if (m & Mtd::TR) {
+        if (!c.cached (Mtd::TR))
+            c.tr.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_TR), Vmcs::read (Vmcs::GUEST_BASE_TR), Vmcs::read (Vmcs::GUEST_LIMIT_TR), Vmcs::read (Vmcs::GUEST_AR_TR));
+        tr = c.tr;
+    }
 
-    if (m & Mtd::LDTR)
-        ld.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_LDTR), Vmcs::read (Vmcs::GUEST_BASE_LDTR), Vmcs::read (Vmcs::GUEST_LIMIT_LDTR), Vmcs::read (Vmcs::GUEST_AR_LDTR));
+    if (m & Mtd::LDTR) {
+        if (!c.cached (Mtd::LDTR))
+            c.ld.set_vmx (Vmcs::read (Vmcs::GUEST_SEL_LDTR), Vmcs::read (Vmcs::GUEST_BASE_LDTR), Vmcs::read (Vmcs::GUEST_LIMIT_LDTR), Vmcs::read (Vmcs::GUEST_AR_LDTR));
+        ld = c.ld;
+    }
 
-    if (m & Mtd::GDTR)
-        gd.set_vmx (0, Vmcs::read (Vmcs::GUEST_BASE_GDTR), Vmcs::read (Vmcs::GUEST_LIMIT_GDTR), 0);
+    if (m & Mtd::GDTR) {
+        if (!c.cached (Mtd::GDTR))
+            c.gd.set_vmx (0, Vmcs::read (Vmcs::GUEST_BASE_GDTR), Vmcs::read (Vmcs::GUEST_LIMIT_GDTR), 0);
+        gd = c.gd;
+    }
 
-    if (m & Mtd::IDTR)
-        id.set_vmx (0, Vmcs::read (Vmcs::GUEST_BASE_IDTR), Vmcs::read (Vmcs::GUEST_LIMIT_IDTR), 0);
+    if (m & Mtd::IDTR) {
+        if (!c.cached (Mtd::IDTR))
+            c.id.set_vmx (0, Vmcs::read (Vmcs::GUEST_BASE_IDTR), Vmcs::read (Vmcs::GUEST_LIMIT_IDTR), 0);
+        id = c.id;
+    }
 
     if (m & Mtd::CR) {
         cr0 = regs->read_cr<Vmcs> (0);
@@ -195,13 +237,21 @@ bool Utcb::load_vmx (Cpu_regs *regs)
         cr4 = regs->read_cr<Vmcs> (4);
     }
 
-    if (m & Mtd::DR)
-        dr7 = Vmcs::read (Vmcs::GUEST_DR7);
+    if (m & Mtd::DR) {
+        if (!c.cached (Mtd::DR))
+            c.dr7 = Vmcs::read (Vmcs::GUEST_DR7);
+        dr7 = c.dr7;
+    }
 
     if (m & Mtd::SYSENTER) {
-        sysenter_cs  = Vmcs::read (Vmcs::GUEST_SYSENTER_CS);
-        sysenter_rsp = Vmcs::read (Vmcs::GUEST_SYSENTER_ESP);
-        sysenter_rip = Vmcs::read (Vmcs::GUEST_SYSENTER_EIP);
+        if (!c.cached (Mtd::SYSENTER)) {
+            c.sysenter_cs  = Vmcs::read (Vmcs::GUEST_SYSENTER_CS);
+            c.sysenter_rsp = Vmcs::read (Vmcs::GUEST_SYSENTER_ESP);
+            c.sysenter_rip = Vmcs::read (Vmcs::GUEST_SYSENTER_EIP);
+        }
+        sysenter_cs  = c.sysenter_cs;
+        sysenter_rsp = c.sysenter_rsp;
+        sysenter_rip = c.sysenter_rip;
     }
 
     if (m & Mtd::QUAL) {
@@ -225,8 +275,12 @@ bool Utcb::load_vmx (Cpu_regs *regs)
     }
 
     if (m & Mtd::STA) {
-        intr_state = static_cast<uint32>(Vmcs::read (Vmcs::GUEST_INTR_STATE));
-        actv_state = static_cast<uint32>(Vmcs::read (Vmcs::GUEST_ACTV_STATE));
+        if (!c.cached (Mtd::STA)) {
+            c.intr_state = static_cast<uint32>(Vmcs::read (Vmcs::GUEST_INTR_STATE));
+            c.actv_state = static_cast<uint32>(Vmcs::read (Vmcs::GUEST_ACTV_STATE));
+        }
+        intr_state = c.intr_state;
+        actv_state = c.actv_state;
     }
 
     if (m & Mtd::TSC) {
@@ -266,12 +320,20 @@ bool Utcb::load_vmx (Cpu_regs *regs)
 #endif
 
     if (m & Mtd::PDPTE) {
-        pdpte[0] = Vmcs::read (Vmcs::GUEST_PDPTE0);
-        pdpte[1] = Vmcs::read (Vmcs::GUEST_PDPTE1);
-        pdpte[2] = Vmcs::read (Vmcs::GUEST_PDPTE2);
-        pdpte[3] = Vmcs::read (Vmcs::GUEST_PDPTE3);
+        if (!c.cached (Mtd::PDPTE)) {
+            c.pdpte[0] = Vmcs::read (Vmcs::GUEST_PDPTE0);
+            c.pdpte[1] = Vmcs::read (Vmcs::GUEST_PDPTE1);
+            c.pdpte[2] = Vmcs::read (Vmcs::GUEST_PDPTE2);
+            c.pdpte[3] = Vmcs::read (Vmcs::GUEST_PDPTE3);
+        }
+        pdpte[0] = c.pdpte[0];
+        pdpte[1] = c.pdpte[1];
+        pdpte[2] = c.pdpte[2];
+        pdpte[3] = c.pdpte[3];
     }
 
+    c.validate (m);
+
     exit_value = regs->dst_portal;
 
     barrier();
@@ -311,72 +373,61 @@ bool Utcb::save_vmx (Cpu_regs *regs)
 
     regs->vmcs_state->make_current();
 
-    if (mtd & Mtd::RSP)
+    Vmcs_cache &c = regs->vmcs_state->guest;
+
+    if (mtd & Mtd::RSP && c.update (Mtd::RSP, c.rsp, rsp))
         Vmcs::write (Vmcs::GUEST_RSP, rsp);
 
     if (mtd & Mtd::RIP_LEN) {
-        Vmcs::write (Vmcs::GUEST_RIP, rip);
+        if (c.update (Mtd::RIP_LEN, c.rip, rip))
+            Vmcs::write (Vmcs::GUEST_RIP, rip);
         Vmcs::write (Vmcs::ENT_INST_LEN, inst_len);
     }
 
-    if (mtd & Mtd::RFLAGS)
+    if (mtd & Mtd::RFLAGS && c.update (Mtd::RFLAGS, c.rflags, rflags))
         Vmcs::write (Vmcs::GUEST_RFLAGS, rflags);
 
     if (mtd & Mtd::DS_ES) {
-        Vmcs::write (Vmcs::GUEST_SEL_DS,   ds.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_DS,  static_cast<mword>(ds.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_DS, ds.limit);
-        Vmcs::write (Vmcs::GUEST_AR_DS,   (ds.ar << 4 & 0x1f000) | (ds.ar & 0xff));
-        Vmcs::write (Vmcs::GUEST_SEL_ES,   es.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_ES,  static_cast<mword>(es.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_ES, es.limit);
-        Vmcs::write (Vmcs::GUEST_AR_ES,   (es.ar << 4 & 0x1f000) | (es.ar & 0xff));
+        if (c.update (Mtd::DS_ES, c.ds, ds))
+            write_vmx_seg (ds, Vmcs::GUEST_SEL_DS, Vmcs::GUEST_BASE_DS, Vmcs::GUEST_LIMIT_DS, Vmcs::GUEST_AR_DS);
+        if (c.update (Mtd::DS_ES, c.es, es))
+            write_vmx_seg (es, Vmcs::GUEST_SEL_ES, Vmcs::GUEST_BASE_ES, Vmcs::GUEST_LIMIT_ES, Vmcs::GUEST_AR_ES);
     }
 
     if (mtd & Mtd::FS_GS) {
-        Vmcs::write (Vmcs::GUEST_SEL_FS,   fs.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_FS,  static_cast<mword>(fs.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_FS, fs.limit);
-        Vmcs::write (Vmcs::GUEST_AR_FS,   (fs.ar << 4 & 0x1f000) | (fs.ar & 0xff));
-        Vmcs::write (Vmcs::GUEST_SEL_GS,   gs.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_GS,  static_cast<mword>(gs.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_GS, gs.limit);
-        Vmcs::write (Vmcs::GUEST_AR_GS,   (gs.ar << 4 & 0x1f000) | (gs.ar & 0xff));
+        if (c.update (Mtd::FS_GS, c.fs, fs))
+            write_vmx_seg (fs, Vmcs::GUEST_SEL_FS, Vmcs::GUEST_BASE_FS, Vmcs::GUEST_LIMIT_FS, Vmcs::GUEST_AR_FS);
+        if (c.update (Mtd::FS_GS, c.gs, gs))
+            write_vmx_seg (gs, Vmcs::GUEST_SEL_GS, Vmcs::GUEST_BASE_GS, Vmcs::GUEST_LIMIT_GS, Vmcs::GUEST_AR_GS);
     }
 
     if (mtd & Mtd::CS_SS) {
-        Vmcs::write (Vmcs::GUEST_SEL_CS,   cs.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_CS,  static_cast<mword>(cs.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_CS, cs.limit);
-        Vmcs::write (Vmcs::GUEST_AR_CS,   (cs.ar << 4 & 0x1f000) | (cs.ar & 0xff));
-        Vmcs::write (Vmcs::GUEST_SEL_SS,   ss.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_SS,  static_cast<mword>(ss.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_SS, ss.limit);
-        Vmcs::write (Vmcs::GUEST_AR_SS,   (ss.ar << 4 & 0x1f000) | (ss.ar & 0xff));
+        if (c.update (Mtd::CS_SS, c.cs, cs))
+            write_vmx_seg (cs, Vmcs::GUEST_SEL_CS, Vmcs::GUEST_BASE_CS, Vmcs::GUEST_LIMIT_CS, Vmcs::GUEST_AR_CS);
+        if (c.update (Mtd::CS_SS, c.ss, ss))
+            write_vmx_seg (ss, Vmcs::GUEST_SEL_SS, Vmcs::GUEST_BASE_SS, Vmcs::GUEST_LIMIT_SS, Vmcs::GUEST_AR_SS);
     }
 
-    if (mtd & Mtd::TR) {
-        Vmcs::write (Vmcs::GUEST_SEL_TR,     tr.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_TR,    static_cast<mword>(tr.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_TR,   tr.limit);
-        Vmcs::write (Vmcs::GUEST_AR_TR,     (tr.ar << 4 & 0x1f000) | (tr.ar & 0xff));
-    }
+    if (mtd & Mtd::TR && c.update (Mtd::TR, c.tr, tr))
+        write_vmx_seg (tr, Vmcs::GUEST_SEL_TR, Vmcs::GUEST_BASE_TR, Vmcs::GUEST_LIMIT_TR, Vmcs::GUEST_AR_TR);
 
-    if (mtd & Mtd::LDTR) {
-        Vmcs::write (Vmcs::GUEST_SEL_LDTR,   ld.sel);
-        Vmcs::write (Vmcs::GUEST_BASE_LDTR,  static_cast<mword>(ld.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_LDTR, ld.limit);
-        Vmcs::write (Vmcs::GUEST_AR_LDTR,   (ld.ar << 4 & 0x1f000) | (ld.ar & 0xff));
-    }
+    if (mtd & Mtd::LDTR && c.update (Mtd::LDTR, c.ld, ld))
+        write_vmx_seg (ld, Vmcs::GUEST_SEL_LDTR, Vmcs::GUEST_BASE_LDTR, Vmcs::GUEST_LIMIT_LDTR, Vmcs::GUEST_AR_LDTR);
 
     if (mtd & Mtd::GDTR) {
-        Vmcs::write (Vmcs::GUEST_BASE_GDTR,  static_cast<mword>(gd.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_GDTR, gd.limit);
+        Utcb_segment d { }; d.set_vmx (0, static_cast<mword>(gd.base), gd.limit, 0);
+        if (c.update (Mtd::GDTR, c.gd, d)) {
+            Vmcs::write (Vmcs::GUEST_BASE_GDTR,  static_cast<mword>(gd.base));
+            Vmcs::write (Vmcs::GUEST_LIMIT_GDTR, gd.limit);
+        }
     }
 
     if (mtd & Mtd::IDTR) {
-        Vmcs::write (Vmcs::GUEST_BASE_IDTR,  static_cast<mword>(id.base));
-        Vmcs::write (Vmcs::GUEST_LIMIT_IDTR, id.limit);
+        Utcb_segment d { }; d.set_vmx (0, static_cast<mword>(id.base), id.limit, 0);
+        if (c.update (Mtd::IDTR, c.id, d)) {
+            Vmcs::write (Vmcs::GUEST_BASE_IDTR,  static_cast<mword>(id.base));
+            Vmcs::write (Vmcs::GUEST_LIMIT_IDTR, id.limit);
+        }
     }
 
     if (mtd & Mtd::CR) {
@@ -386,13 +437,16 @@ bool Utcb::save_vmx (Cpu_regs *regs)
         regs->write_cr<Vmcs> (4, cr4);
     }
 
-    if (mtd & Mtd::DR)
+    if (mtd & Mtd::DR && c.update (Mtd::DR, c.dr7, dr7))
         Vmcs::write (Vmcs::GUEST_DR7, dr7);
 
     if (mtd & Mtd::SYSENTER) {
-        Vmcs::write (Vmcs::GUEST_SYSENTER_CS,  sysenter_cs);
-        Vmcs::write (Vmcs::GUEST_SYSENTER_ESP, sysenter_rsp);
-        Vmcs::write (Vmcs::GUEST_SYSENTER_EIP, sysenter_rip);
+        if (c.update (Mtd::SYSENTER, c.sysenter_cs, sysenter_cs))
+            Vmcs::write (Vmcs::GUEST_SYSENTER_CS,  sysenter_cs);
+        if (c.update (Mtd::SYSENTER, c.sysenter_rsp, sysenter_rsp))
+            Vmcs::write (Vmcs::GUEST_SYSENTER_ESP, sysenter_rsp);
+        if (c.update (Mtd::SYSENTER, c.sysenter_rip, sysenter_rip))
+            Vmcs::write (Vmcs::GUEST_SYSENTER_EIP, sysenter_rip);
     }
 
     if (mtd & Mtd::CTRL) {
@@ -421,8 +475,10 @@ bool Utcb::save_vmx (Cpu_regs *regs)
     }
 
     if (mtd & Mtd::STA) {
-        Vmcs::write (Vmcs::GUEST_INTR_STATE, intr_state);
-        Vmcs::write (Vmcs::GUEST_ACTV_STATE, actv_state);
+        if (c.update (Mtd::STA, c.intr_state, intr_state))
+            Vmcs::write (Vmcs::GUEST_INTR_STATE, intr_state);
+        if (c.update (Mtd::STA, c.actv_state, actv_state))
+            Vmcs::write (Vmcs::GUEST_ACTV_STATE, actv_state);
     }
 
     if (mtd & Mtd::TSC)
@@ -465,12 +521,18 @@ bool Utcb::save_vmx (Cpu_regs *regs)
 #endif
 
     if (mtd & Mtd::PDPTE) {
-        Vmcs::write (Vmcs::GUEST_PDPTE0, pdpte[0]);
-        Vmcs::write (Vmcs::GUEST_PDPTE1, pdpte[1]);
-        Vmcs::write (Vmcs::GUEST_PDPTE2, pdpte[2]);
-        Vmcs::write (Vmcs::GUEST_PDPTE3, pdpte[3]);
+        if (c.update (Mtd::PDPTE, c.pdpte[0], pdpte[0]))
+            Vmcs::write (Vmcs::GUEST_PDPTE0, pdpte[0]);
+        if (c.update (Mtd::PDPTE, c.pdpte[1], pdpte[1]))
+            Vmcs::write (Vmcs::GUEST_PDPTE1, pdpte[1]);
+        if (c.update (Mtd::PDPTE, c.pdpte[2], pdpte[2]))
+            Vmcs::write (Vmcs::GUEST_PDPTE2, pdpte[2]);
+        if (c.update (Mtd::PDPTE, c.pdpte[3], pdpte[3]))
+            Vmcs::write (Vmcs::GUEST_PDPTE3, pdpte[3]);
     }
 
+    c.validate (mtd);
+
     if (mtd & Mtd::TSC_AUX)
         regs->tsc_aux = tsc_aux;
 
@@ -663,9 +725,12 @@ bool Utcb::save_svm (Cpu_regs *regs)
     if (mtd & Mtd::RFLAGS)
         vmcb->rflags = rflags;
 
-    if (mtd & Mtd::DS_ES) {
+    Vmcb_state * const state = regs->vmcb_state;
+
+    if (mtd & Mtd::DS_ES && !(vmcb->ds == ds && vmcb->es == es)) {
         vmcb->ds = ds;
         vmcb->es = es;
+        state->mark (Vmcb::CLEAN_SEG);
     }
 
     if (mtd & Mtd::FS_GS) {
@@ -673,9 +738,10 @@ bool Utcb::save_svm (Cpu_regs *regs)
         vmcb->gs = gs;
     }
 
-    if (mtd & Mtd::CS_SS) {
+    if (mtd & Mtd::CS_SS && !(vmcb->cs == cs && vmcb->ss == ss)) {
         vmcb->cs = cs;
         vmcb->ss = ss;
+        state->mark (Vmcb::CLEAN_SEG);
     }
 
     if (mtd & Mtd::TR)
@@ -684,11 +750,15 @@ bool Utcb::save_svm (Cpu_regs *regs)
     if (mtd & Mtd::LDTR)
         vmcb->ldtr = ld;
 
-    if (mtd & Mtd::GDTR)
+    if (mtd & Mtd::GDTR && !(vmcb->gdtr == gd)) {
         vmcb->gdtr = gd;
+        state->mark (Vmcb::CLEAN_DT);
+    }
 
-    if (mtd & Mtd::IDTR)
+    if (mtd & Mtd::IDTR && !(vmcb->idtr == id)) {
         vmcb->idtr = id;
+        state->mark (Vmcb::CLEAN_DT);
+    }
 
     if (mtd & Mtd::CR) {
         regs->write_cr<Vmcb> (0, cr0);
@@ -697,8 +767,10 @@ bool Utcb::save_svm (Cpu_regs *regs)
         regs->write_cr<Vmcb> (4, cr4);
     }
 
-    if (mtd & Mtd::DR)
+    if (mtd & Mtd::DR && vmcb->dr7 != dr7) {
         vmcb->dr7 = dr7;
+        state->mark (Vmcb::CLEAN_DRX);
+    }
 
     if (mtd & Mtd::SYSENTER) {
         vmcb->sysenter_cs  = sysenter_cs;
@@ -707,6 +779,7 @@ bool Utcb::save_svm (Cpu_regs *regs)
     }
 
     if (mtd & Mtd::CTRL) {
+        regs->pause_vmm = !!(ctrl[0] & Vmcb::CPU_PAUSE);
         regs->svm_set_cpu_ctrl0 (ctrl[0]);
         regs->svm_set_cpu_ctrl1 (ctrl[1]);
     }
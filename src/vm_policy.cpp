@@ -0,0 +1,73 @@
+/*
+ * Virtual-Machine Exit Policy
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "utcb.hpp"
+#include "vm_policy.hpp"
+
+static_assert (sizeof (Vm_policy) <= PAGE_SIZE, "Vm_policy too large");
+
+unsigned Vm_policy::stat[NUM_CPU][NUM_REASONS];
+
+/*
+ * Set the enabled exit reasons to m. If the UTCB carries items, both
+ * tables are replaced by them; otherwise the tables are kept.
+ */
+bool Vm_policy::configure (mword m, Utcb &utcb)
+{
+    if (m & ~((1UL << NUM_REASONS) - 1))
+        return false;
+
+    if (!utcb.ucnt()) {
+        mask = m;
+        return true;
+    }
+
+    unsigned c = 0, n = 0;
+
+    bool ok = utcb.for_each_item<Item>([&](Item const &i) {
+        switch (i.type) {
+            case Item::TYPE_CPUID: return ++c <= CPUID_ENTRIES;
+            case Item::TYPE_MSR:   return ++n <= MSR_ENTRIES;
+            default:               return false;
+        }
+    });
+
+    if (!ok)
+        return false;
+
+    cpuids = msrs = 0;
+
+    utcb.for_each_item<Item>([&](Item const &i) {
+        if (i.type == Item::TYPE_CPUID) {
+            Cpuid &e = cpuid[cpuids++];
+            e.leaf    = i.key;
+            e.subleaf = i.subkey;
+            e.flags   = i.flags;
+            e.eax     = static_cast<uint32>(i.val[0]);
+            e.ebx     = static_cast<uint32>(i.val[0] >> 32);
+            e.ecx     = static_cast<uint32>(i.val[1]);
+            e.edx     = static_cast<uint32>(i.val[1] >> 32);
+        } else {
+            Msr &e = msr[msrs++];
+            e.index = i.key;
+            e.value = i.val[0];
+        }
+        return true;
+    });
+
+    mask = m;
+
+    return true;
+}
@@ -29,13 +29,14 @@
 #include "stdio.hpp"
 #include "tss.hpp"
 #include "util.hpp"
+#include "vectors.hpp"
 #include "vmx.hpp"
 #include "x86.hpp"
 #include "pd.hpp"
 
 Vmcs *              Vmcs::current;
 Vmcs *              Vmcs::root;
-unsigned            Vmcs::vpid_ctr;
+unsigned            Vmcs::preempt_rate;
 Vmcs::vmx_basic     Vmcs::basic;
 Vmcs::vmx_ept_vpid  Vmcs::ept_vpid;
 Vmcs::vmx_ctrl_pin  Vmcs::ctrl_pin;
@@ -46,6 +47,8 @@ mword               Vmcs::fix_cr0_set, Vmcs::fix_cr0_clr;
 mword               Vmcs::fix_cr4_set, Vmcs::fix_cr4_clr;
 
 Queue<Vmcs_state>   Vmcs_state::queue;
+unsigned            Vmcs_state::loaded[NUM_CPU];
+unsigned            Vmcs_state::stat[NUM_CPU][Vmcs_state::NUM_STATS];
 
 INIT_PRIORITY (PRIO_SLAB)
 Slab_cache Vmcs_state::cache (sizeof (Vmcs_state), 8);
@@ -65,9 +68,7 @@ Vmcs::Vmcs (Quota &quota, mword esp, mword bmp, mword cr3, uint64 eptp) : rev (b
     write (VMCS_LINK_PTR,    ~0ul);
     write (VMCS_LINK_PTR_HI, ~0ul);
 
-    write (VPID, ++vpid_ctr);
-
-    write (EPTP,    static_cast<mword>(eptp) | (Ept::max() - 1) << 3 | 6);
+    write (EPTP,    static_cast<mword>(eptp) | (has_ept_ad() ? 1UL << 6 : 0) | (Ept::max() - 1) << 3 | 6);
     write (EPTP_HI, static_cast<mword>(eptp >> 32));
 
     write (IO_BITMAP_A, bmp);
@@ -85,6 +86,9 @@ Vmcs::Vmcs (Quota &quota, mword esp, mword bmp, mword cr3, uint64 eptp) : rev (b
     ent |= ENT_LOAD_EFER;
 #endif
 
+    if (has_preempt())
+        pin |= PIN_PREEMPT_TIMER;
+
     write (PIN_CONTROLS, (pin | ctrl_pin.set) & ctrl_pin.clr);
     write (EXI_CONTROLS, (exi | ctrl_exi.set) & ctrl_exi.clr);
     write (ENT_CONTROLS, (ent | ctrl_ent.set) & ctrl_ent.clr);
@@ -120,6 +124,23 @@ Vmcs::Vmcs (Quota &quota, mword esp, mword bmp, mword cr3, uint64 eptp) : rev (b
     mword virtual_apic_page_phys = Buddy::ptr_to_phys(new (quota) Virtual_apic_page);
     write (APIC_VIRT_ADDR, virtual_apic_page_phys);
 
+    /* allocate and register the posted-interrupt descriptor */
+    if (has_posted()) {
+        write (PI_DESC_ADDR, Buddy::ptr_to_phys(new (quota) Pi_desc));
+        write (PI_NOTIFY_VECTOR, VEC_IPI_PIN);
+        write (GUEST_INTR_STATUS, 0);
+        write (EOI_EXIT_BITMAP0, 0);
+        write (EOI_EXIT_BITMAP1, 0);
+        write (EOI_EXIT_BITMAP2, 0);
+        write (EOI_EXIT_BITMAP3, 0);
+    }
+
+    /* allocate and register the page-modification log */
+    if (has_pml()) {
+        write (PML_ADDR, Buddy::ptr_to_phys(new (quota) Pml_log));
+        write (GUEST_PML_INDEX, Pml_log::ENTRIES - 1);
+    }
+
     /* allocate and register the guest MSR permission bitmap */
     if (Vmcs::use_msr_bitmap()) {
         auto       &msr_bitmap      = *new (quota) Msr_bitmap;
@@ -154,6 +175,8 @@ void Vmcs::init()
 
     if (has_secondary())
         ctrl_cpu[1].val = Msr::read<uint64>(Msr::IA32_VMX_CTRL_CPU1);
+    if (has_preempt())
+        preempt_rate = Msr::read<uint32>(Msr::IA32_VMX_CTRL_MISC) & 0x1f;
     if (has_ept() || has_vpid())
         ept_vpid.val = Msr::read<uint64>(Msr::IA32_VMX_EPT_VPID);
     if (has_ept())
@@ -172,9 +195,11 @@ void Vmcs::init()
 
     if (Cmdline::vtlb || !ept_vpid.invept)
         ctrl_cpu[1].clr &= ~(CPU_EPT | CPU_URG);
-    if (Cmdline::novpid || !ept_vpid.invvpid)
+    if (Cmdline::novpid || !ept_vpid.invvpid || !ept_vpid.invvpid_ctx || !ept_vpid.invvpid_all)
         ctrl_cpu[1].clr &= ~CPU_VPID;
 
+    Tlb_tag<Vmcs>::max = 0xffff;
+
     set_cr0 ((get_cr0() & ~fix_cr0_clr) | fix_cr0_set);
     set_cr4 ((get_cr4() & ~fix_cr4_clr) | fix_cr4_set);
 
@@ -183,7 +208,10 @@ void Vmcs::init()
 
     root->vmxon();
 
-    trace (TRACE_VMX, "VMCS:%#010lx REV:%#x EPT:%d URG:%d VNMI:%d VPID:%d", Buddy::ptr_to_phys (root), basic.revision, has_ept(), has_urg(), has_vnmi(), has_vpid());
+    if (has_posted())
+        Hip::set_feature (Hip::FEAT_PINT);
+
+    trace (TRACE_VMX, "VMCS:%#010lx REV:%#x EPT:%d URG:%d VNMI:%d VPID:%d PINT:%d PML:%d PRE:%d", Buddy::ptr_to_phys (root), basic.revision, has_ept(), has_urg(), has_vnmi(), has_vpid(), has_posted(), has_pml(), has_preempt());
 }
 
 void Vmcs_state::destroy(Vmcs_state * const remove, Quota &quota)
@@ -198,6 +226,12 @@ void Vmcs_state::destroy(Vmcs_state * const remove, Quota &quota)
     auto const virtual_apic_page_phys = Vmcs::read(Vmcs::APIC_VIRT_ADDR);
     auto const msr_bitmap_phys        = Vmcs::read(Vmcs::MSR_BITMAP);
 
+    if (remove->pi)
+        Pi_desc::destroy(remove->pi, quota);
+
+    if (remove->pml)
+        Pml_log::destroy(remove->pml, quota);
+
     remove->clear();
 
     auto * host_msr_area = reinterpret_cast<Msr_area *>(Buddy::phys_to_ptr(host_msr_area_phys));
@@ -219,3 +253,88 @@ void Vmcs_state::destroy(Vmcs_state * const remove, Quota &quota)
     remove->~Vmcs_state();
     cache.free (remove, quota);
 }
+
+void Vmcs_state::sync_eoi()
+{
+    eoi_on = false;
+
+    for (unsigned i = 0; i < 4; i++) {
+        Vmcs::Encoding const enc = static_cast<Vmcs::Encoding>(Vmcs::EOI_EXIT_BITMAP0 + i * 2);
+
+        Vmcs::write (enc, eoi[i * 2]);
+        Vmcs::write (static_cast<Vmcs::Encoding>(enc + 1), eoi[i * 2 + 1]);
+    }
+}
+
+/*
+ * Record the pages logged since the last drain in the dirty log of the PD
+ * and rewind the log. A full log has an index beyond the last entry.
+ */
+void Vmcs_state::drain_pml (Dirty_log &log)
+{
+    mword idx = Vmcs::read (Vmcs::GUEST_PML_INDEX) & 0xffff;
+
+    if (idx == Pml_log::ENTRIES - 1)
+        return;
+
+    for (mword i = idx < Pml_log::ENTRIES ? idx + 1 : 0; i < Pml_log::ENTRIES; i++)
+        log.mark (pml->gpa[i]);
+
+    Vmcs::write (Vmcs::GUEST_PML_INDEX, Pml_log::ENTRIES - 1);
+}
+
+/*
+ * A posted vector ends a guest HLT only if the guest takes it right away:
+ * interrupts enabled, no interrupt shadow, and a priority class above the
+ * processor priority of the virtual APIC.
+ */
+bool Vmcs_state::deliverable() const
+{
+    if (!pi->pending())
+        return false;
+
+    if (!(Vmcs::read (Vmcs::GUEST_RFLAGS) & Cpu::EFL_IF) || Vmcs::read (Vmcs::GUEST_INTR_STATE) & 3)
+        return false;
+
+    auto &vapic = *reinterpret_cast<Virtual_apic_page *>(Buddy::phys_to_ptr(Vmcs::read (Vmcs::APIC_VIRT_ADDR)));
+
+    unsigned vec = 0;
+
+    for (unsigned i = 8; i--; ) {
+        uint32 const irr = ACCESS_ONCE (pi->pir[i]) | vapic.virr (i);
+
+        if (irr) {
+            vec = i * 32 + static_cast<unsigned>(bit_scan_reverse (irr));
+            break;
+        }
+    }
+
+    unsigned const svi = static_cast<unsigned>(Vmcs::read (Vmcs::GUEST_INTR_STATUS) >> 8 & 0xff);
+
+    return (vec & 0xf0) > (max (vapic.vtpr(), svi) & 0xf0);
+}
+
+/*
+ * Move vectors posted while the vCPU was not in guest mode into the virtual
+ * IRR and raise RVI, as the processor would have done on notification.
+ */
+void Vmcs_state::sync_posted()
+{
+    pi->acknowledge();
+
+    auto &vapic = *reinterpret_cast<Virtual_apic_page *>(Buddy::phys_to_ptr(Vmcs::read (Vmcs::APIC_VIRT_ADDR)));
+
+    unsigned rvi = 0;
+
+    for (unsigned i = 8; i--; ) {
+        vapic.virr (i) |= pi->take (i);
+
+        if (!rvi && vapic.virr (i))
+            rvi = i * 32 + static_cast<unsigned>(bit_scan_reverse (vapic.virr (i)));
+    }
+
+    mword status = Vmcs::read (Vmcs::GUEST_INTR_STATUS);
+
+    if (rvi > (status & 0xff))
+        Vmcs::write (Vmcs::GUEST_INTR_STATUS, (status & ~0xfful) | rvi);
+}
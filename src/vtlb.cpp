@@ -19,22 +19,124 @@
  */
 
 #include "counter.hpp"
+#include "lock_guard.hpp"
 #include "pd.hpp"
 #include "regs.hpp"
 #include "stdio.hpp"
 #include "vtlb.hpp"
 
-size_t Vtlb::gwalk (Exc_regs *regs, mword gla, mword &gpa, mword &attr, mword &error)
+#ifdef __x86_64__
+/*
+ * Walk PAE and long-mode guest page tables. Legacy PAE starts from the
+ * PDPTEs loaded with CR3, long mode from the PML4 at CR3. With EFER.NXE,
+ * an execute-disable bit at any level denies instruction fetches.
+ */
+size_t Vtlb::gwalk_pae (Cpu_regs *regs, mword gla, mword &gpa, mword &attr, mword &error)
+{
+    uint64 const addr = 0xffffffffff000ULL;
+
+    mword efer = regs->guest_efer();
+
+    bool lma = efer & Cpu::EFER_LMA;
+    bool nxe = efer & Cpu::EFER_NXE;
+    bool pge = regs->cr4_shadow & Cpu::CR4_PGE;
+    bool wp  = regs->cr0_shadow & Cpu::CR0_WP;
+    bool nx  = false;
+
+    if (!nxe)
+        error &= ~ERR_I;
+
+    unsigned lev = lma ? 4 : 2;
+
+    uint64 e = lma ? regs->cr3_shadow : regs->guest_pdpte (gla >> 30 & 3);
+
+    Vtlb_track *t = regs->vtlb_pd->vtlb_track;
+
+    if (!lma && t)
+        t->track (regs->cr3_shadow);
+
+    if (EXPECT_FALSE (!lma && !(e & TLB_P)))
+        return 0;
+
+    for (uint64 *pte;;) {
+
+        unsigned shift = --lev * 9 + PAGE_BITS;
+        pte = reinterpret_cast<uint64 *>(e & addr) + (gla >> shift & ((1UL << 9) - 1));
+
+        if (t)
+            t->track (reinterpret_cast<mword>(pte));
+
+        if (User::peek (pte, e) != ~0UL) {
+            gpa = reinterpret_cast<Paddr>(pte);
+            return ~0UL;
+        }
+
+        if (EXPECT_FALSE (!(e & TLB_P)))
+            return 0;
+
+        attr &= e & PAGE_MASK;
+
+        if (nxe && e & TLB_NX)
+            nx = true;
+
+        if (lev && (lev == 3 || !(e & TLB_S))) {
+            mark_pte (reinterpret_cast<uint32 *>(pte), static_cast<uint32>(e), TLB_A);
+            continue;
+        }
+
+        if (EXPECT_FALSE (!wp && error == ERR_W))
+            attr = (attr & ~TLB_U) | TLB_W;
+
+        mword access = error & (ERR_U | ERR_W);
+
+        if (EXPECT_FALSE ((attr & access) != access || (nx && error & ERR_I))) {
+            error |= ERR_P;
+            return 0;
+        }
+
+        if (!(error & ERR_W) && !(e & TLB_D))
+            attr &= ~TLB_W;
+
+        mark_pte (reinterpret_cast<uint32 *>(pte), static_cast<uint32>(e), static_cast<uint32>((attr & 3) << 5));
+
+        attr |= e & TLB_UC;
+
+        if (nx)
+            attr |= TLB_NX;
+
+        if (EXPECT_TRUE (pge) && (e & TLB_G))
+            attr |= TLB_M;
+
+        size_t size = 1UL << shift;
+
+        gpa = static_cast<mword>(e & addr & ~(size - 1)) | (gla & (size - 1));
+
+        return size;
+    }
+}
+#endif
+
+size_t Vtlb::gwalk (Cpu_regs *regs, mword gla, mword &gpa, mword &attr, mword &error)
 {
     if (EXPECT_FALSE (!(regs->cr0_shadow & Cpu::CR0_PG))) {
         gpa = gla;
         return ~0UL;
     }
 
+#ifdef __x86_64__
+    if (regs->cr4_shadow & Cpu::CR4_PAE)
+        return gwalk_pae (regs, gla, gpa, attr, error);
+#endif
+
+    /* no execute-disable without PAE */
+    error &= ~ERR_I;
+
     bool pse = regs->cr4_shadow & (Cpu::CR4_PSE | Cpu::CR4_PAE);
     bool pge = regs->cr4_shadow &  Cpu::CR4_PGE;
     bool wp  = regs->cr0_shadow &  Cpu::CR0_WP;
 
+    Vtlb_track *t = regs->vtlb_pd->vtlb_track;
+
     unsigned lev = 2;
 
     for (uint32 e, *pte= reinterpret_cast<uint32 *>(regs->cr3_shadow & ~PAGE_MASK);; pte = reinterpret_cast<uint32 *>(e & ~PAGE_MASK)) {
@@ -42,6 +144,9 @@ size_t Vtlb::gwalk (Exc_regs *regs, mword gla, mword &gpa, mword &attr, mword &e
         unsigned shift = --lev * 10 + PAGE_BITS;
         pte += gla >> shift & ((1UL << 10) - 1);
 
+        if (t)
+            t->track (reinterpret_cast<mword>(pte));
+
         if (User::peek (pte, e) != ~0UL) {
             gpa = reinterpret_cast<Paddr>(pte);
             return ~0UL;
@@ -110,7 +215,7 @@ Vtlb::Reason Vtlb::miss (Cpu_regs *regs, mword virt, mword &error)
 
     trace (TRACE_VTLB, "VTLB Miss CR3:%#010lx A:%#010lx E:%#lx", regs->cr3_shadow, virt, error);
 
-    error &= ERR_U | ERR_W;
+    error &= ERR_U | ERR_W | ERR_I;
 
     size_t gsize = gwalk (regs, virt, phys, attr, error);
 
@@ -119,6 +224,8 @@ Vtlb::Reason Vtlb::miss (Cpu_regs *regs, mword virt, mword &error)
         return GLA_GPA;
     }
 
+    error &= ~ERR_I;
+
     size_t hsize = hwalk (phys, host, attr, error);
 
     if (EXPECT_FALSE (!hsize)) {
@@ -130,12 +237,17 @@ Vtlb::Reason Vtlb::miss (Cpu_regs *regs, mword virt, mword &error)
 
     size_t size = min (gsize, hsize);
 
-    if (gsize > hsize)
+    if (Vtlb_track *t = regs->vtlb_pd->vtlb_track)
+        t->protect (regs, phys, size, attr, error);
+
+    if (gsize > size)
         attr |= TLB_F;
 
     Counter::print<1,16> (++Counter::vtlb_fill, Console_vga::COLOR_LIGHT_MAGENTA, SPN_VFI);
 
-    unsigned lev = max();
+    bool lm = regs->vtlb_lm;
+
+    unsigned lev = levels (lm);
 
     for (Vtlb *tlb = regs->vtlb;; tlb = static_cast<Vtlb *>(Buddy::phys_to_ptr (tlb->addr()))) {
 
@@ -144,10 +256,10 @@ Vtlb::Reason Vtlb::miss (Cpu_regs *regs, mword virt, mword &error)
 
         if (lev) {
 
-            if (lev == 2 || size < 1UL << shift) {
+            if (lev >= 2 || size < 1UL << shift) {
 
                 if (tlb->super())
-                    tlb->val = static_cast<typeof tlb->val>(Buddy::ptr_to_phys (new (Pd::current->quota) Vtlb) | (lev == 2 ? 0 : TLB_A | TLB_U | TLB_W) | TLB_M | TLB_P);
+                    tlb->val = static_cast<typeof tlb->val>(Buddy::ptr_to_phys (new (regs->vtlb_pd->quota) Vtlb) | (lev == 2 && !lm ? 0 : TLB_A | TLB_U | TLB_W) | TLB_M | TLB_P);
 
                 else if (!tlb->present()) {
                     static_cast<Vtlb *>(Buddy::phys_to_ptr (tlb->addr()))->flush_ptab (tlb->mark());
@@ -161,7 +273,7 @@ Vtlb::Reason Vtlb::miss (Cpu_regs *regs, mword virt, mword &error)
             }
 
             if (!tlb->super())
-                Vtlb::destroy(static_cast<Vtlb *>(Buddy::phys_to_ptr (tlb->addr())), Pd::current->quota);
+                Vtlb::destroy(static_cast<Vtlb *>(Buddy::phys_to_ptr (tlb->addr())), regs->vtlb_pd->quota);
 
             attr |= TLB_S;
         }
@@ -189,9 +301,42 @@ void Vtlb::flush_ptab (bool full)
     }
 }
 
-void Vtlb::flush (mword virt)
+void Vtlb::free_ptab (Quota &quota, unsigned lev)
+{
+    for (Vtlb *e = this; e < this + (1UL << bpl()); e++) {
+
+        if (e->super())
+            continue;
+
+        Vtlb *p = static_cast<Vtlb *>(Buddy::phys_to_ptr (e->addr()));
+
+        if (lev > 1)
+            p->free_ptab (quota, lev - 1);
+
+        Vtlb::destroy (p, quota);
+
+        e->val = TLB_S;
+    }
+}
+
+/*
+ * The hardware walks the shadow tables in the paging mode of the guest, so
+ * tables built for the other depth must not survive a long-mode switch.
+ */
+void Vtlb::depth (Cpu_regs *regs, bool lm)
+{
+    if (regs->vtlb_cache)
+        regs->vtlb_cache->free_roots (regs->vtlb_pd->quota, levels (regs->vtlb_lm) - 1);
+
+    regs->vtlb->free_ptab (regs->vtlb_pd->quota, levels (regs->vtlb_lm) - 1);
+    regs->vtlb_lm = lm;
+
+    Counter::print<1,16> (++Counter::vtlb_flush, Console_vga::COLOR_LIGHT_RED, SPN_VFL);
+}
+
+void Vtlb::flush (mword virt, bool lm)
 {
-    unsigned l = max();
+    unsigned l = levels (lm);
 
     for (Vtlb *e = this;; e = static_cast<Vtlb *>(Buddy::phys_to_ptr (e->addr()))) {
 
@@ -219,3 +364,306 @@ void Vtlb::flush (bool full)
 
     Counter::print<1,16> (++Counter::vtlb_flush, Console_vga::COLOR_LIGHT_RED, SPN_VFL);
 }
+
+Vtlb_track::Vtlb_track (Quota &quota) : frame (static_cast<mword *>(Buddy::allocator.alloc (MAP_ORDER, quota, Buddy::FILL_0)))
+{
+    static_assert (sizeof (Vtlb_track) <= PAGE_SIZE, "VTLB track exceeds a page");
+}
+
+void Vtlb_track::destroy (Vtlb_track *obj, Quota &quota)
+{
+    Buddy::allocator.free (reinterpret_cast<mword>(obj->frame), quota);
+
+    obj->~Vtlb_track();
+
+    Buddy::allocator.free (reinterpret_cast<mword>(obj), quota);
+}
+
+bool Vtlb_track::tracked (mword gpa, size_t size) const
+{
+    if (gpa >= limit())
+        return false;
+
+    if (size <= PAGE_SIZE)
+        return test (frame, gpa >> PAGE_BITS);
+
+    for (mword r = gpa >> REGION_BITS; r <= (gpa + size - 1) >> REGION_BITS; r++)
+        if (test (region, r))
+            return true;
+
+    return false;
+}
+
+/*
+ * Start a dirty generation, every vCPU has to flush completely again
+ */
+void Vtlb_track::invalidate()
+{
+    Lock_guard <Spinlock> guard (lock);
+
+    gen    = (gen | 1) + 1;
+    synced = 0;
+}
+
+Vtlb_track::State Vtlb_track::state (Cpu_regs const *regs) const
+{
+    mword g = generation();
+
+    if (regs->vtlb_gen != g)
+        return STALE;
+
+    return g & 1 ? FRESH : WAIT;
+}
+
+/*
+ * Record a frame the guest walk read an entry from. A frame beyond the
+ * tracked range cannot be protected, so no root may be cached.
+ */
+void Vtlb_track::track (uint64 gpa)
+{
+    if (EXPECT_FALSE (gpa >= limit())) {
+        invalidate();
+        return;
+    }
+
+    mword f = static_cast<mword>(gpa >> PAGE_BITS);
+
+    if (EXPECT_TRUE (test (frame, f)))
+        return;
+
+    set (frame, f);
+    set (region, static_cast<mword>(gpa >> REGION_BITS));
+
+    invalidate();
+}
+
+/*
+ * Fill writable leaves covering tracked frames with 4K pages, read-only
+ * unless the fault is the write itself. A vCPU that has not flushed since
+ * the last generation started may hold writable mappings anyway.
+ */
+void Vtlb_track::protect (Cpu_regs const *regs, mword gpa, size_t &size, mword &attr, mword error)
+{
+    if (!(attr & Vtlb::TLB_W))
+        return;
+
+    mword g = generation();
+
+    if (regs->vtlb_gen != g && !(g & 1 && regs->vtlb_gen + 1 == g))
+        return;
+
+    if (size > PAGE_SIZE && tracked (gpa & ~(size - 1), size))
+        size = PAGE_SIZE;
+
+    if (size > PAGE_SIZE || !tracked (gpa & ~PAGE_MASK, PAGE_SIZE))
+        return;
+
+    if (error & Vtlb::ERR_W)
+        invalidate();
+    else
+        attr &= ~Vtlb::TLB_W;
+}
+
+/*
+ * Record a complete flush of the active root of a vCPU. The last vCPU to
+ * flush in a dirty generation starts a clean one, its own flush is
+ * already past that point.
+ */
+void Vtlb_track::sync (Cpu_regs *regs)
+{
+    Lock_guard <Spinlock> guard (lock);
+
+    if (regs->vtlb_gen == gen)
+        return;
+
+    regs->vtlb_gen = gen;
+
+    if (gen & 1 || ++synced < regs->vtlb_pd->vcpus)
+        return;
+
+    regs->vtlb_gen = ++gen;
+    synced = 0;
+}
+
+/*
+ * A destroyed vCPU no longer holds back a clean generation
+ */
+void Vtlb_track::detach (Cpu_regs const *regs)
+{
+    Lock_guard <Spinlock> guard (lock);
+
+    unsigned n = Atomic::sub (regs->vtlb_pd->vcpus, 1U);
+
+    if (gen & 1)
+        return;
+
+    if (regs->vtlb_gen == gen)
+        synced--;
+
+    if (n && synced == n) {
+        gen++;
+        synced = 0;
+    }
+}
+
+void Vtlb_cache::destroy (Vtlb_cache *obj, Quota &quota, unsigned lev)
+{
+    obj->free_roots (quota, lev);
+
+    for (Slot *s = obj->slot; s < obj->slot + ROOTS; s++)
+        if (s->root)
+            Vtlb::destroy (s->root, quota);
+
+    obj->~Vtlb_cache();
+
+    Buddy::allocator.free (reinterpret_cast<mword>(obj), quota);
+}
+
+void Vtlb_cache::free_roots (Quota &quota, unsigned lev)
+{
+    for (Slot *s = slot; s < slot + ROOTS; s++) {
+
+        if (s->root)
+            s->root->free_ptab (quota, lev);
+
+        s->valid = false;
+    }
+}
+
+void Vtlb_cache::unsafe()
+{
+    if (!safe)
+        return;
+
+    safe    = false;
+    backoff = hits ? 1 : min (backoff * 2, static_cast<unsigned>(BACKOFF));
+    hits    = 0;
+
+    for (Slot *s = slot; s < slot + ROOTS; s++)
+        s->valid = false;
+}
+
+/*
+ * The active root of a vCPU was flushed completely
+ */
+void Vtlb_cache::flushed (Cpu_regs *regs)
+{
+    Vtlb_track *t = regs->vtlb_pd->vtlb_track;
+
+    if (t)
+        t->sync (regs);
+
+    Vtlb_cache *c = regs->vtlb_cache;
+
+    if (!c)
+        return;
+
+    for (Slot *s = c->slot; s < c->slot + ROOTS; s++)
+        s->valid = false;
+
+    c->safe = true;
+    c->gen  = t ? t->generation() : 0;
+}
+
+Vtlb_cache::Result Vtlb_cache::load (Cpu_regs *regs, mword cr3)
+{
+    Pd *pd = regs->vtlb_pd;
+    Vtlb_cache *c = regs->vtlb_cache;
+    Vtlb_track *t = pd->vtlb_track;
+
+    if (!(regs->cr0_shadow & Cpu::CR0_PG)) {
+        if (c)
+            c->unsafe();
+        return FLUSH;
+    }
+
+    if (EXPECT_FALSE (!t)) {
+
+        if (pd->quota.hit_limit (1 + Vtlb_track::map_pages))
+            return FLUSH;
+
+        t = new (pd->quota) Vtlb_track (pd->quota);
+
+        // Another vCPU installed the tracking state first
+        if (!Atomic::cmp_swap (pd->vtlb_track, static_cast<Vtlb_track *>(nullptr), t)) {
+            Vtlb_track::destroy (t, pd->quota);
+            t = pd->vtlb_track;
+        }
+    }
+
+    if (EXPECT_FALSE (!c)) {
+
+        if (pd->quota.hit_limit (1))
+            return FLUSH;
+
+        c = regs->vtlb_cache = new (pd->quota) Vtlb_cache;
+    }
+
+    mword g = t->generation();
+
+    if (c->gen != g) {
+        c->unsafe();
+        c->gen = g;
+    }
+
+    Vtlb_track::State st = t->state (regs);
+
+    if (c->safe && st == Vtlb_track::WAIT)
+        return FLUSH;
+
+    if (!c->safe || st != Vtlb_track::FRESH) {
+
+        if (++c->probe < c->backoff)
+            return FLUSH;
+
+        c->probe = 0;
+
+        return FLUSH_ALL;
+    }
+
+    if (cr3 == regs->cr3_shadow) {
+        c->hits++;
+        return HIT;
+    }
+
+    Slot *v = c->slot;
+
+    for (Slot *s = c->slot; s < c->slot + ROOTS; s++) {
+
+        if (s->valid && s->cr3 == cr3) {
+            Vtlb *root = s->root;
+            s->root = regs->vtlb;
+            s->cr3  = regs->cr3_shadow;
+            s->used = ++c->stamp;
+            regs->vtlb = root;
+            c->hits++;
+            return SWITCH;
+        }
+
+        /* Prefer dropped roots, then unused slots, then the least recently used */
+        unsigned rs = s->valid ? 2 : !s->root, rv = v->valid ? 2 : !v->root;
+
+        if (rs < rv || (rs == rv && s->used < v->used))
+            v = s;
+    }
+
+    Vtlb *root = v->root;
+
+    if (root)
+        root->flush_ptab (!v->valid);
+
+    else if (pd->quota.hit_limit (1))
+        return FLUSH;
+
+    else
+        root = new (pd->quota) Vtlb;
+
+    v->root  = regs->vtlb;
+    v->cr3   = regs->cr3_shadow;
+    v->used  = ++c->stamp;
+    v->valid = true;
+
+    regs->vtlb = root;
+
+    return SWITCH;
+}